@@ -0,0 +1,112 @@
+/* Bump-pointer allocation.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.  */
+
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+/* Blocks start small, as many arenas only ever hold a few strings, and
+   double from there up to a limit.  A larger allocation gets a block of
+   its own size.  */
+
+#define MIN_BLOCK 1024
+#define MAX_BLOCK (64 * 1024)
+
+struct arena_block
+    {
+    struct arena_block *next;
+    size_t size;
+    };
+
+#define BLOCK_HEADER \
+  ((sizeof (struct arena_block) + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1))
+
+#define BLOCK_DATA(b) ((char *) (b) + BLOCK_HEADER)
+
+/* The slow path of arena_alloc: continue in the next block kept from
+   before a reset, or add a new one after the current block.  */
+
+void *
+arena_alloc_block (struct arena *a, size_t size)
+    {
+    struct arena_block *b = a->cur ? a->cur->next : a->first;
+
+    if (b == NULL || b->size < size)
+        {
+        size_t bsize = a->cur ? 2 * a->cur->size : MIN_BLOCK;
+
+        if (bsize > MAX_BLOCK)
+            bsize = MAX_BLOCK;
+        if (bsize < size)
+            bsize = size;
+        b = malloc (BLOCK_HEADER + bsize);
+        if (b == NULL)
+            return NULL;
+        b->size = bsize;
+        a->nblocks++;
+        if (a->cur)
+            {
+            b->next = a->cur->next;
+            a->cur->next = b;
+            }
+        else
+            {
+            b->next = a->first;
+            a->first = b;
+            }
+        }
+
+    a->cur = b;
+    a->ptr = BLOCK_DATA (b) + size;
+    a->end = BLOCK_DATA (b) + b->size;
+    return BLOCK_DATA (b);
+    }
+
+char *
+arena_strdup (struct arena *a, const char *s)
+    {
+    size_t len = strlen (s) + 1;
+    char *p = arena_alloc (a, len);
+
+    if (p != NULL)
+        memcpy (p, s, len);
+    return p;
+    }
+
+void
+arena_reset (struct arena *a)
+    {
+    a->cur = a->first;
+    if (a->first != NULL)
+        {
+        a->ptr = BLOCK_DATA (a->first);
+        a->end = a->ptr + a->first->size;
+        }
+    }
+
+void
+arena_release (struct arena *a)
+    {
+    struct arena_block *b, *next;
+
+    for (b = a->first; b != NULL; b = next)
+        {
+        next = b->next;
+        free (b);
+        }
+    a->first = a->cur = NULL;
+    a->ptr = a->end = NULL;
+    }
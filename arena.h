@@ -0,0 +1,78 @@
+/* Bump-pointer allocation.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.  */
+
+/* An arena hands out memory from a few large blocks, for data that is
+   all dropped at the same time.  Nothing is freed on its own; a reset
+   makes the whole arena available again without giving the blocks
+   back, and a release frees them.  An arena that is all zeros is empty
+   and ready for use.  An arena is not locked, so only one thread may
+   use it at a time.  */
+
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#define ARENA_ALIGN 16
+
+struct arena_block;
+
+struct arena
+    {
+    struct arena_block *first, *cur;
+    char *ptr, *end;
+    /* Allocations served, and blocks allocated to serve them, since
+       the arena was created; kept across resets and releases.  */
+    unsigned long nallocs;
+    unsigned long nblocks;
+    };
+
+extern void	*arena_alloc_block (struct arena *, size_t);
+
+/* SIZE bytes from arena A, aligned to ARENA_ALIGN, or NULL if out of
+   memory.  */
+static inline void *
+arena_alloc (struct arena *a, size_t size)
+    {
+    void *p;
+
+    size = (size + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+    a->nallocs++;
+    if ((size_t) (a->end - a->ptr) < size)
+        return arena_alloc_block (a, size);
+    p = a->ptr;
+    a->ptr += size;
+    return p;
+    }
+
+/* A copy of string S in arena A, or NULL if out of memory.  */
+extern char	*arena_strdup	(struct arena *, const char *);
+
+/* Make everything allocated from A available again.  */
+extern void	arena_reset	(struct arena *);
+
+/* Free the blocks of A, leaving it empty.  */
+extern void	arena_release	(struct arena *);
+
+#ifdef __cplusplus
+    }
+#endif /* __cplusplus */
+
+#endif /* __ARENA_H__ */
@@ -0,0 +1,141 @@
+/* Time hash table inserts and lookups.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.  */
+
+/* This is built twice, against hashtab.c and against the table it
+   replaced, kept in bench/old.  The entries are like those debugedit
+   keeps: 16 bytes keyed on a 32-bit section offset that is its own
+   hash value.  Each case inserts N keys spaced STRIDE apart, looks all
+   of them up again in a scattered order, and looks up as many keys
+   that are not there.
+
+   debugedit's own offset-keyed tables hold an entry per CU, line table
+   or unit string, so a few thousand at most, inserted in ascending
+   order; the cases of 1000 and 10000 keys 256 apart are like those.
+   The cases of 100000 keys and more stand for much larger tables.  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include "hashtab.h"
+
+struct entry
+    {
+    uint32_t offset;
+    char pad[12];
+    };
+
+static hashval_t
+entry_hash (const void *p)
+    {
+    return ((const struct entry *) p)->offset;
+    }
+
+static int
+entry_eq (const void *p, const void *q)
+    {
+    return ((const struct entry *) p)->offset
+           == ((const struct entry *) q)->offset;
+    }
+
+static double
+now (void)
+    {
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+    }
+
+/* The key of entry I; a little jitter keeps it from being a plain
+   multiple of STRIDE.  */
+
+static uint32_t
+key (size_t i, uint32_t stride)
+    {
+    return (uint32_t) (i * stride + (i * 7919) % 13);
+    }
+
+static int
+run_case (size_t n, uint32_t stride, int rounds)
+    {
+    struct entry *es = malloc (n * sizeof (*es));
+    struct entry k;
+    size_t i, hits = 0, misses = 0;
+    double t0, t1, t2, t3;
+    htab_t h;
+    int r;
+
+    if (es == NULL)
+        return 1;
+    for (i = 0; i < n; i++)
+        es[i].offset = key (i, stride);
+
+    t0 = now ();
+    h = htab_try_create (16, entry_hash, entry_eq, NULL);
+    if (h == NULL)
+        return 1;
+    for (i = 0; i < n; i++)
+        {
+        void **slot = htab_find_slot_with_hash (h, &es[i], es[i].offset,
+                                                INSERT);
+
+        if (slot == NULL)
+            return 1;
+        *slot = &es[i];
+        }
+    t1 = now ();
+    for (r = 0; r < rounds; r++)
+        for (i = 0; i < n; i++)
+            {
+            size_t j = (i * 2654435761u) % n;
+
+            hits += htab_find_with_hash (h, &es[j], es[j].offset) != NULL;
+            }
+    t2 = now ();
+    for (r = 0; r < rounds; r++)
+        for (i = 0; i < n; i++)
+            {
+            k.offset = key (i, stride) + 0x40000000u + stride / 2;
+            misses += htab_find_with_hash (h, &k, k.offset) == NULL;
+            }
+    t3 = now ();
+
+    printf ("%8zu keys, stride %3u: insert %6.1f  hit %6.1f  miss %6.1f"
+            " ns/op\n", n, stride, (t1 - t0) * 1e9 / n,
+            (t2 - t1) * 1e9 / ((double) rounds * n),
+            (t3 - t2) * 1e9 / ((double) rounds * n));
+    htab_delete (h);
+    free (es);
+    return hits != (size_t) rounds * n || misses != (size_t) rounds * n;
+    }
+
+int
+main (int argc, char *argv[])
+    {
+    int bad = 0;
+
+    printf ("%s\n", argc > 1 ? argv[1] : "hashtab");
+    bad |= run_case (1000, 1, 1000);
+    bad |= run_case (1000, 256, 1000);
+    bad |= run_case (10000, 256, 100);
+    bad |= run_case (100000, 1, 20);
+    bad |= run_case (100000, 64, 20);
+    bad |= run_case (2000000, 16, 4);
+    if (bad)
+        fprintf (stderr, "lookups returned wrong results\n");
+    return bad;
+    }
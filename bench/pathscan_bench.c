@@ -0,0 +1,266 @@
+/* Check and time the pathscan kernels against each other.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.  */
+
+/* The kernels are static, so pathscan.c is built into this program
+   directly.  Every kernel the CPU supports is first run on random paths
+   at every alignment and compared with the scalar one, and on strings
+   that end right before an unmapped page, which they must not fault
+   on.  Then each is timed on the same set of build-tree like paths.  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "../pathscan.c"
+
+#define NPATHS 1000
+#define ROUNDS 2000
+
+struct kernels
+    {
+    const char *name;
+    const char *(*find_slash_run) (const char *);
+    void (*path_to_win) (char *);
+    };
+
+static struct kernels kernels[] =
+    {
+    { "scalar", find_slash_run_scalar, path_to_win_scalar },
+#ifdef PATHSCAN_X86
+    { "sse2", find_slash_run_sse2, path_to_win_sse2 },
+    { "avx2", find_slash_run_avx2, path_to_win_avx2 },
+#endif
+    };
+
+#define NKERNELS (sizeof (kernels) / sizeof (kernels[0]))
+
+static int
+kernel_supported (size_t k)
+    {
+#ifdef PATHSCAN_X86
+    if (strcmp (kernels[k].name, "sse2") == 0)
+        return __builtin_cpu_supports ("sse2");
+    if (strcmp (kernels[k].name, "avx2") == 0)
+        return __builtin_cpu_supports ("avx2");
+#endif
+    return 1;
+    }
+
+static double
+now (void)
+    {
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+    }
+
+/* A random path of LEN bytes, mostly names with the odd "//", "/." or
+   "/..", into S.  */
+
+static void
+random_path (char *s, size_t len)
+    {
+    static const char chars[] = "//////....abcdefgh_-";
+    size_t i;
+
+    for (i = 0; i < len; i++)
+        s[i] = chars[rand () % (sizeof (chars) - 1)];
+    s[len] = '\0';
+    }
+
+static int
+check_kernel (size_t k, char *buf, const char *s)
+    {
+    size_t len = strlen (s);
+    char want[256];
+
+    if (kernels[k].find_slash_run (s) != find_slash_run_scalar (s))
+        return 0;
+    memcpy (want, s, len + 1);
+    path_to_win_scalar (want);
+    memcpy (buf, s, len + 1);
+    kernels[k].path_to_win (buf);
+    return memcmp (buf, want, len + 1) == 0;
+    }
+
+/* Compare every kernel with the scalar one.  Returns the number of
+   mismatches.  */
+
+static unsigned long
+check_random (void)
+    {
+    static char in[512] __attribute__ ((aligned (64)));
+    static char out[512] __attribute__ ((aligned (64)));
+    unsigned long bad = 0;
+    int i;
+    size_t k, off;
+
+    for (i = 0; i < 20000; i++)
+        {
+        size_t len = rand () % 200;
+
+        for (off = 0; off < 64; off++)
+            {
+            random_path (in + off, len);
+            for (k = 1; k < NKERNELS; k++)
+                if (kernel_supported (k)
+                        && !check_kernel (k, out + off, in + off))
+                    bad++;
+            }
+        }
+    return bad;
+    }
+
+/* Run every kernel on strings of every length up to 256 whose NUL is
+   the last byte before an unmapped page.  A fault kills the bench.  */
+
+static unsigned long
+check_guard_page (void)
+    {
+    long page = sysconf (_SC_PAGESIZE);
+    char *map = mmap (NULL, 2 * page, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    char *end, want[300];
+    unsigned long bad = 0;
+    size_t len, k;
+
+    if (map == MAP_FAILED || mprotect (map + page, page, PROT_NONE) != 0)
+        {
+        perror ("mmap");
+        exit (1);
+        }
+    end = map + page - 1;
+    for (len = 0; len <= 256; len++)
+        {
+        char *s = end - len;
+
+        for (k = 0; k < NKERNELS; k++)
+            {
+            if (!kernel_supported (k))
+                continue;
+            random_path (s, len);
+            memcpy (want, s, len + 1);
+            if (kernels[k].find_slash_run (s) != find_slash_run_scalar (want)
+                    - want + s)
+                bad++;
+            path_to_win_scalar (want);
+            kernels[k].path_to_win (s);
+            if (memcmp (s, want, len + 1) != 0)
+                bad++;
+            }
+        }
+    munmap (map, 2 * page);
+    return bad;
+    }
+
+/* Paths like those of a build tree: a common prefix, a few directory
+   levels and a file name, about 40 to 70 bytes, mostly canonical.  */
+
+static char **
+make_paths (void)
+    {
+    static const char *dirs[] = { "arch", "arm", "cpu", "arm32ve", "core",
+                                  "drivers", "libs", "include", "emulators",
+                                  "commands", "build", "." };
+    char **paths = malloc (NPATHS * sizeof (char *));
+    int i, j;
+
+    for (i = 0; i < NPATHS; i++)
+        {
+        char buf[256];
+        size_t len = snprintf (buf, sizeof (buf), "/cygdrive/E/Work/xvisor");
+
+        for (j = 0; j < 2 + rand () % 4; j++)
+            len += snprintf (buf + len, sizeof (buf) - len, "/%s",
+                             dirs[rand () % (sizeof (dirs) / sizeof (dirs[0]))]);
+        snprintf (buf + len, sizeof (buf) - len, "/file%d.c", i);
+        paths[i] = strdup (buf);
+        }
+    return paths;
+    }
+
+/* path_to_win is timed on fresh copies of the paths, less the time
+   the copying takes on its own.  */
+
+static void
+time_kernel (size_t k, char **paths)
+    {
+    static char copy[256] __attribute__ ((aligned (64)));
+    const char *volatile sink;
+    double t0, t1, t2, t3;
+    int r, i;
+
+    t0 = now ();
+    for (r = 0; r < ROUNDS; r++)
+        for (i = 0; i < NPATHS; i++)
+            sink = kernels[k].find_slash_run (paths[i]);
+    t1 = now ();
+    for (r = 0; r < ROUNDS; r++)
+        for (i = 0; i < NPATHS; i++)
+            {
+            strcpy (copy, paths[i]);
+            kernels[k].path_to_win (copy);
+            }
+    t2 = now ();
+    for (r = 0; r < ROUNDS; r++)
+        for (i = 0; i < NPATHS; i++)
+            {
+            strcpy (copy, paths[i]);
+            __asm__ volatile ("" : : "r" (copy) : "memory");
+            }
+    t3 = now ();
+    (void) sink;
+
+    printf ("%-8s find_slash_run %6.1f ns/path   path_to_win %6.1f ns/path\n",
+            kernels[k].name, (t1 - t0) * 1e9 / ((double) ROUNDS * NPATHS),
+            ((t2 - t1) - (t3 - t2)) * 1e9 / ((double) ROUNDS * NPATHS));
+    }
+
+int
+main (void)
+    {
+    unsigned long bad;
+    char **paths;
+    size_t k, total = 0;
+    int i;
+
+#ifdef PATHSCAN_X86
+    __builtin_cpu_init ();
+#endif
+    srand (1);
+
+    bad = check_random ();
+    printf ("random paths: %lu mismatches\n", bad);
+    if (bad == 0)
+        {
+        bad = check_guard_page ();
+        printf ("strings ending at a guard page: %lu mismatches\n", bad);
+        }
+    if (bad != 0)
+        return 1;
+
+    paths = make_paths ();
+    for (i = 0; i < NPATHS; i++)
+        total += strlen (paths[i]);
+    printf ("%d paths, %zu bytes on average\n", NPATHS, total / NPATHS);
+    for (k = 0; k < NKERNELS; k++)
+        if (kernel_supported (k))
+            time_kernel (k, paths);
+    return 0;
+    }
@@ -0,0 +1,157 @@
+/* A hash set shared between threads.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.  */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include "chashtab.h"
+
+#define SHARD_BITS 6
+#define NSHARDS (1 << SHARD_BITS)
+#define CACHE_LINE 64
+
+/* Each shard starts on a cache line of its own, so that taking one
+   lock never disturbs a thread working in a neighbouring shard.  The
+   table a shard points to is allocated on its own as well.  */
+
+struct chtab_shard
+    {
+    pthread_mutex_t lock;
+    htab_t htab;
+    } __attribute__ ((aligned (CACHE_LINE)));
+
+struct chtab
+    {
+    struct chtab_shard shards[NSHARDS];
+    };
+
+/* The shard tables index by the high bits of the hash value times the
+   golden ratio, so the shard is picked with a different mix, or all
+   entries of a shard would crowd into one corner of its table.  */
+
+static inline struct chtab_shard *
+chtab_shard (chtab_t t, hashval_t hash)
+    {
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bU;
+    hash ^= hash >> 13;
+    return &t->shards[hash & (NSHARDS - 1)];
+    }
+
+chtab_t
+chtab_create (size_t size, htab_hash hash_f, htab_eq eq_f, htab_del del_f)
+    {
+    chtab_t t;
+    int i;
+
+    if (posix_memalign ((void **) &t, CACHE_LINE, sizeof (*t)) != 0)
+        return NULL;
+
+    for (i = 0; i < NSHARDS; i++)
+        {
+        t->shards[i].htab = htab_try_create (size / NSHARDS + 1,
+                                             hash_f, eq_f, del_f);
+        if (t->shards[i].htab == NULL)
+            {
+            while (--i >= 0)
+                {
+                htab_delete (t->shards[i].htab);
+                pthread_mutex_destroy (&t->shards[i].lock);
+                }
+            free (t);
+            return NULL;
+            }
+        pthread_mutex_init (&t->shards[i].lock, NULL);
+        }
+    return t;
+    }
+
+void
+chtab_delete (chtab_t t)
+    {
+    int i;
+
+    for (i = 0; i < NSHARDS; i++)
+        {
+        htab_delete (t->shards[i].htab);
+        pthread_mutex_destroy (&t->shards[i].lock);
+        }
+    free (t);
+    }
+
+void *
+chtab_find (chtab_t t, const void *key, hashval_t hash)
+    {
+    struct chtab_shard *s = chtab_shard (t, hash);
+    void *e;
+
+    pthread_mutex_lock (&s->lock);
+    e = htab_find_with_hash (s->htab, key, hash);
+    pthread_mutex_unlock (&s->lock);
+    return e;
+    }
+
+void *
+chtab_insert (chtab_t t, const void *key, hashval_t hash, void *entry)
+    {
+    struct chtab_shard *s = chtab_shard (t, hash);
+    void **slot;
+
+    pthread_mutex_lock (&s->lock);
+    slot = htab_find_slot_with_hash (s->htab, key, hash, INSERT);
+    if (slot != NULL)
+        {
+        if (*slot == NULL)
+            *slot = entry;
+        entry = *slot;
+        }
+    else
+        entry = NULL;
+    pthread_mutex_unlock (&s->lock);
+    return entry;
+    }
+
+size_t
+chtab_elements (chtab_t t)
+    {
+    size_t n = 0;
+    int i;
+
+    for (i = 0; i < NSHARDS; i++)
+        n += htab_elements (t->shards[i].htab);
+    return n;
+    }
+
+unsigned long
+chtab_searches (chtab_t t)
+    {
+    unsigned long n = 0;
+    int i;
+
+    for (i = 0; i < NSHARDS; i++)
+        n += t->shards[i].htab->searches;
+    return n;
+    }
+
+unsigned long
+chtab_collisions (chtab_t t)
+    {
+    unsigned long n = 0;
+    int i;
+
+    for (i = 0; i < NSHARDS; i++)
+        n += t->shards[i].htab->collisions;
+    return n;
+    }
@@ -0,0 +1,66 @@
+/* A hash set shared between threads.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.  */
+
+/* A chtab is an insert-only set of entries that any number of threads
+   may look up and add to at once.  It is split into shards by hash
+   value, each a plain htab with a lock of its own and on cache lines of
+   its own, so threads only wait for each other when they hash into the
+   same shard.  The search and collision counts are those of the shard
+   tables, which are only ever touched under their shard's lock.
+
+   The callbacks are those of htab, and as with htab_find_with_hash the
+   entry in the table is passed first to the comparison function, so a
+   key may be of a different type than the entries.  Entries are never
+   removed until the whole set is deleted.  */
+
+#ifndef __CHASHTAB_H__
+#define __CHASHTAB_H__
+
+#include <stddef.h>
+#include "hashtab.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+typedef struct chtab *chtab_t;
+
+/* A set with room for about SIZE entries before any shard grows, or
+   NULL if out of memory.  DEL, if not NULL, is called on every entry
+   when the set is deleted.  */
+extern chtab_t	chtab_create	(size_t, htab_hash, htab_eq, htab_del);
+extern void	chtab_delete	(chtab_t);
+
+/* The entry equal to KEY, whose hash value is HASH, or NULL.  */
+extern void    *chtab_find	(chtab_t, const void *, hashval_t);
+
+/* Add ENTRY, equal to KEY and with hash value HASH, unless an equal
+   entry is already there.  Returns the entry now in the set, which is
+   ENTRY only if it was added, or NULL if out of memory.  */
+extern void    *chtab_insert	(chtab_t, const void *, hashval_t, void *);
+
+/* The number of entries, and the searches made and collisions met in
+   the shard tables so far.  Not to be called while other threads use
+   the set.  */
+extern size_t	chtab_elements	(chtab_t);
+extern unsigned long chtab_searches (chtab_t);
+extern unsigned long chtab_collisions (chtab_t);
+
+#ifdef __cplusplus
+    }
+#endif /* __cplusplus */
+
+#endif /* __CHASHTAB_H__ */
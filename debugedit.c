@@ -17,6 +17,8 @@
    Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.  */
 
 
+#define _GNU_SOURCE
+
 /* Needed for libelf */
 #define _FILE_OFFSET_BITS 64
 
@@ -30,7 +32,16 @@
 #include <error.h>
 #else
 #include <err.h>
-#define error(x, y, format, args...) errx(1, format, ## args)
+/* Like glibc's error: only a nonzero status is fatal, so that a bad
+   file does not stop a batch run.  */
+#define error(status, errnum, format, args...) do {    \
+    if (errnum)                                         \
+        warnc (errnum, format, ## args);                \
+    else                                                \
+        warnx (format, ## args);                        \
+    if (status)                                         \
+        exit (status);                                  \
+    } while (0)
 #endif
 #include <limits.h>
 #include <string.h>
@@ -39,13 +50,21 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <popt.h>
+#include <pthread.h>
 
 #include <gelf.h>
 #include <sys/elf_common.h>
 #include "dwarf.h"
 #include "hashtab.h"
+#include "chashtab.h"
+#include "arena.h"
+#include "leb128.h"
+#include "pathmap.h"
+#include "pathscan.h"
+#include "workq.h"
 
 #define DW_TAG_partial_unit 0x3c
 #define DW_FORM_sec_offset 0x17
@@ -62,13 +81,117 @@
 
 char *base_dir = NULL;
 char *dest_dir = NULL;
+char *map_file = NULL;
 char *list_file = NULL;
 int win_path = 0;
 int list_file_fd = -1;
 int use_newline = 0;
 int list_only_files = 0;
+int sort_list = 0;
+int strings_first = 0;
 FILE *debug_fd;
 int be_quiet = 0;
+int verbose = 0;
+int show_stats = 0;
+int all_dies = 0;
+int num_jobs = 1;
+int in_place = 0;
+int rebuild_strings = 0;
+
+/* Threads to walk the CUs of one file with; 1 when a batch of files is
+   already spread over the threads.  */
+static int cu_jobs = 1;
+
+/* Set when dest dir is longer than base dir, so that strings can only
+   be rewritten by rebuilding the tables they live in.  */
+static int grow_paths = 0;
+
+/* The -b/-d pair and the --map-file rules.  PATH_MAP is NULL without any
+   base dir; REWRITE_PATHS is set if some rule has a dest dir, and
+   MAX_DEST_LEN is the longest of those.  */
+static path_map_t path_map;
+static int rewrite_paths = 0;
+static size_t max_dest_len = 0;
+
+/* Byte strings one of which occurs in every file a rule with a dest dir
+   can apply to: the base dirs themselves, or their common prefix when
+   there are too many to search for one by one.  None if that prefix is
+   no more than "/", in which case nothing is prefiltered.  */
+#define MAX_NEEDLES 8
+static const char *needles[MAX_NEEDLES];
+static size_t needle_lens[MAX_NEEDLES];
+static size_t nneedles;
+
+/* Trace output: -v shows what is done per file and unit, -vv per line
+   table entry and symbol as well.  Below the level nothing is
+   formatted.  */
+#define TRACE(level, format, args...) do {             \
+    if (__builtin_expect (verbose >= (level), 0))       \
+        fprintf (debug_fd, format, ## args);            \
+    } while (0)
+
+struct debug_section
+    {
+    const char *name;
+    unsigned char *data;
+    Elf_Data *elf_data;
+    size_t size;
+    int sec, relsec;
+    /* DATA has been replaced by a rebuilt copy of our own.  */
+    int rebuilt;
+    };
+
+#define DEBUG_INFO    0
+#define DEBUG_ABBREV    1
+#define DEBUG_LINE    2
+#define DEBUG_ARANGES    3
+#define DEBUG_PUBNAMES    4
+#define DEBUG_PUBTYPES    5
+#define DEBUG_MACINFO    6
+#define DEBUG_LOC    7
+#define DEBUG_STR    8
+#define DEBUG_FRAME    9
+#define DEBUG_RANGES    10
+#define DEBUG_TYPES    11
+#define DEBUG_MACRO    12
+#define DEBUG_GDB_SCRIPT    13
+#define DEBUG_SYMTAB    14
+#define NUM_DEBUG_SECTIONS    15
+
+static const char *const debug_section_names[NUM_DEBUG_SECTIONS + 1] =
+    {
+    ".debug_info",
+    ".debug_abbrev",
+    ".debug_line",
+    ".debug_aranges",
+    ".debug_pubnames",
+    ".debug_pubtypes",
+    ".debug_macinfo",
+    ".debug_loc",
+    ".debug_str",
+    ".debug_frame",
+    ".debug_ranges",
+    ".debug_types",
+    ".debug_macro",
+    ".debug_gdb_scripts",
+    ".symtab",
+    NULL
+    };
+
+/* List file output, collected in memory until it can be written out in
+   order.  */
+
+typedef struct
+    {
+    char *buf;
+    size_t len, size;
+    } LIST;
+
+/*
+ * Everything known about one file being edited.  Several files may be
+ * edited at once in a batch run, so nothing specific to a file is kept
+ * outside of it.
+ */
 
 typedef struct
     {
@@ -77,37 +200,128 @@ typedef struct
     Elf_Scn **scn;
     const char *filename;
     int lastscn;
+    /* With -m, the private mapping of the file that libelf reads from
+       and all edits are made in, until write_back_map.  */
+    void *map;
+    size_t map_size;
+    /* Readers and writer for the byte order of the file.  */
+    uint16_t (*do_read_16) (unsigned char *ptr);
+    uint32_t (*do_read_32) (unsigned char *ptr);
+    void (*write_32) (unsigned char *ptr, GElf_Addr val);
+    int ptr_size;
+    /* A copy of .debug_info with its relocations applied, or NULL if it
+       has none.  */
+    unsigned char *info_relocated;
+    int dirty_elf;
+    htab_t abbrev_cache;
+    /* The abbreviation tags of the cached tables.  */
+    struct arena arena;
+    /* Whether .debug_str and .debug_line are rebuilt rather than edited
+       in place, and the new unit strings for the former by offset.  */
+    int rebuild_str, rebuild_line;
+    htab_t str_rewrites;
+    /* A bit per .debug_str offset, set once the unit string there has
+       been looked at.  */
+    unsigned char *str_seen;
+    /* The .debug_line offsets already handled, with the comp_dir each
+       was handled under.  */
+    htab_t line_tables;
+    /* The list file paths of line table entries, while the line jobs
+       run; see list_file_path.  */
+    chtab_t path_cache;
+    /* Counters reported by -s.  */
+    struct
+        {
+        unsigned long abbrev_hits;
+        unsigned long abbrev_misses;
+        unsigned long line_repeats;
+        unsigned long path_hits;
+        unsigned long path_misses;
+        unsigned long arena_allocs;
+        unsigned long arena_blocks;
+        int prefiltered;
+        } stats;
+    LIST list;
+    struct debug_section debug_sections[NUM_DEBUG_SECTIONS + 1];
     GElf_Shdr shdr[0];
     } DSO;
 
+/* A queued rewrite of a unit DIE string, see apply_patches.  */
+
+typedef struct
+    {
+    int kind;
+    unsigned int form;
+    char *str;
+    } PATCH;
+
+/*
+ * A DIE with a compilation directory: the list file entry for it and,
+ * if it has a DW_AT_stmt_list, the line table to edit under it.  Jobs
+ * may run on any thread, so their list file output and the sections
+ * they dirty are collected here and flushed in CU order afterwards.
+ */
+
+typedef struct
+    {
+    char *comp_dir;
+    uint32_t list_offs;
+    int has_line;
+    /* LINE_FIRST, LINE_REPEAT or LINE_CONFLICT.  */
+    int repeat;
+    LIST list;
+    unsigned int dirty;
+    /* The rewritten line table, when .debug_line is rebuilt.  */
+    unsigned char *line;
+    size_t line_len;
+    /* The counters of the job's scratch arena and of its path cache
+       lookups, for -s.  */
+    unsigned long arena_allocs, arena_blocks;
+    unsigned long path_hits, path_misses;
+    } LINE_JOB;
+
+/* A line table handled by an earlier job under the same comp_dir is
+   skipped; under a different one it is handled again, after all the
+   first jobs.  */
+
+#define LINE_FIRST 0
+#define LINE_REPEAT 1
+#define LINE_CONFLICT 2
+
+/* A DW_FORM_strp or DW_AT_stmt_list offset in .debug_info that has to
+   be rewritten once .debug_str or .debug_line (SEC) is rebuilt.  */
+
 typedef struct
     {
     unsigned char *ptr;
-    uint32_t addend;
-    } REL;
-
-#define read_uleb128(ptr) ({        \
-  unsigned int ret = 0;            \
-  unsigned int c;            \
-  int shift = 0;            \
-  do                    \
-    {                    \
-      c = *ptr++;            \
-      ret |= (c & 0x7f) << shift;    \
-      shift += 7;            \
-    } while (c & 0x80);            \
-                    \
-  if (shift >= 35)            \
-    ret = UINT_MAX;            \
-  ret;                    \
-})
+    uint32_t offset;
+    int sec;
+    } FIXUP;
 
-static uint16_t (*do_read_16) (unsigned char *ptr);
-static uint32_t (*do_read_32) (unsigned char *ptr);
-static void (*write_32) (unsigned char *ptr, GElf_Addr val);
+/* Everything needed to walk one CU, so that CUs can be walked on any
+   thread.  */
 
-static int ptr_size;
-static int cu_version;
+typedef struct
+    {
+    unsigned char *ptr, *end;
+    int version;
+    struct abbrev_table *abbrev;
+    int failed;
+    PATCH *patches;
+    size_t npatches, max_patches;
+    LINE_JOB *jobs;
+    size_t njobs, max_jobs;
+    FIXUP *fixups;
+    size_t nfixups, max_fixups;
+    /* The comp_dir strings of the CU, for its line jobs and patches.  */
+    struct arena arena;
+    } CU;
+
+/* Read, or step over, the LEB128 number at PTR, which must end before
+   END; see leb128.h.  */
+
+#define read_uleb128(ptr, end) leb128_read_u (&(ptr), (end))
+#define skip_leb128(ptr, end) leb128_skip (&(ptr), (end))
 
 static inline uint16_t
 buf_read_ule16 (unsigned char *data)
@@ -158,44 +372,64 @@ strptr (DSO *dso, int sec, off_t offset)
 
 #define read_1(ptr) *ptr++
 
-#define read_16(ptr) ({                    \
-  uint16_t ret = do_read_16 (ptr);            \
+#define read_16(dso, ptr) ({                \
+  uint16_t ret = (dso)->do_read_16 (ptr);        \
   ptr += 2;                        \
   ret;                            \
 })
 
-#define read_32(ptr) ({                    \
-  uint32_t ret = do_read_32 (ptr);            \
+#define read_32(dso, ptr) ({                \
+  uint32_t ret = (dso)->do_read_32 (ptr);        \
   ptr += 4;                        \
   ret;                            \
 })
 
-REL *relptr, *relend;
-int reltype;
-
-#define do_read_32_relocated(ptr) ({            \
-  uint32_t dret = do_read_32 (ptr);            \
-  if (relptr)                        \
-    {                            \
-      while (relptr < relend && relptr->ptr < ptr)    \
-    ++relptr;                    \
-      if (relptr < relend && relptr->ptr == ptr)    \
-    {                        \
-      if (reltype == SHT_REL)            \
-        dret += relptr->addend;            \
-      else                        \
-        dret = relptr->addend;            \
-    }                        \
-    }                            \
-  dret;                            \
+/* Relocated reads of .debug_info look at the same offset in the
+   relocated copy, if there is one.  */
+
+#define do_read_32_relocated(dso, ptr) ({            \
+  unsigned char *rptr = (ptr);                    \
+  if ((dso)->info_relocated)                    \
+    rptr = (dso)->info_relocated                \
+       + (rptr - (dso)->debug_sections[DEBUG_INFO].data);    \
+  (dso)->do_read_32 (rptr);                    \
 })
 
-#define read_32_relocated(ptr) ({            \
-  uint32_t ret = do_read_32_relocated (ptr);        \
+#define read_32_relocated(dso, ptr) ({            \
+  uint32_t ret = do_read_32_relocated (dso, ptr);    \
   ptr += 4;                        \
   ret;                            \
 })
 
+/* The DIE walker is instead built once for each byte order, and for
+   .debug_info with and without a relocated copy, with BIG_ENDIAN and
+   RELOCATED constant in each, so that these reads are inlined into it
+   rather than called through the DSO.  See walk_cu.  */
+
+#define ALWAYS_INLINE inline __attribute__ ((always_inline))
+
+static ALWAYS_INLINE uint16_t
+buf_read_16 (unsigned char *ptr, int big_endian)
+    {
+    return big_endian ? buf_read_ube16 (ptr) : buf_read_ule16 (ptr);
+    }
+
+static ALWAYS_INLINE uint32_t
+buf_read_32 (unsigned char *ptr, int big_endian)
+    {
+    return big_endian ? buf_read_ube32 (ptr) : buf_read_ule32 (ptr);
+    }
+
+static ALWAYS_INLINE uint32_t
+buf_read_info_32 (DSO *dso, unsigned char *ptr, int big_endian,
+                  int relocated)
+    {
+    if (relocated)
+        ptr = dso->info_relocated
+              + (ptr - dso->debug_sections[DEBUG_INFO].data);
+    return buf_read_32 (ptr, big_endian);
+    }
+
 static void
 dwarf2_write_le32 (unsigned char *p, GElf_Addr val)
     {
@@ -219,63 +453,202 @@ dwarf2_write_be32 (unsigned char *p, GElf_Addr val)
     p[0] = v >> 24;
     }
 
-static struct
-    {
-    const char *name;
-    unsigned char *data;
-    Elf_Data *elf_data;
-    size_t size;
-    int sec, relsec;
-    } debug_sections[] =
-    {
-#define DEBUG_INFO    0
-#define DEBUG_ABBREV    1
-#define DEBUG_LINE    2
-#define DEBUG_ARANGES    3
-#define DEBUG_PUBNAMES    4
-#define DEBUG_PUBTYPES    5
-#define DEBUG_MACINFO    6
-#define DEBUG_LOC    7
-#define DEBUG_STR    8
-#define DEBUG_FRAME    9
-#define DEBUG_RANGES    10
-#define DEBUG_TYPES    11
-#define DEBUG_MACRO    12
-#define DEBUG_GDB_SCRIPT    13
-#define DEBUG_SYMTAB    14
-
-        { ".debug_info", NULL, NULL, 0, 0, 0 },
-        { ".debug_abbrev", NULL, NULL, 0, 0, 0 },
-        { ".debug_line", NULL, NULL, 0, 0, 0 },
-        { ".debug_aranges", NULL, NULL, 0, 0, 0 },
-        { ".debug_pubnames", NULL, NULL, 0, 0, 0 },
-        { ".debug_pubtypes", NULL, NULL, 0, 0, 0 },
-        { ".debug_macinfo", NULL, NULL, 0, 0, 0 },
-        { ".debug_loc", NULL, NULL, 0, 0, 0 },
-        { ".debug_str", NULL, NULL, 0, 0, 0 },
-        { ".debug_frame", NULL, NULL, 0, 0, 0 },
-        { ".debug_ranges", NULL, NULL, 0, 0, 0 },
-        { ".debug_types", NULL, NULL, 0, 0, 0 },
-        { ".debug_macro", NULL, NULL, 0, 0, 0 },
-        { ".debug_gdb_scripts", NULL, NULL, 0, 0, 0 },
-        { ".symtab", NULL, NULL, 0, 0, 0 },
-        { NULL, NULL, NULL, 0, 0, 0 }
-    };
-
 struct abbrev_attr
     {
     unsigned int attr;
     unsigned int form;
     };
 
+/*
+ * A DIE none of whose attributes edit_attributes cares about is skipped
+ * by running its skip program: each step advances over FIXED bytes of
+ * fixed-size forms and then decodes one variable-length FORM, the last
+ * step having FORM 0.
+ */
+
+struct abbrev_skip
+    {
+    uint32_t fixed;
+    uint32_t form;
+    };
+
 struct abbrev_tag
     {
     unsigned int entry;
     unsigned int tag;
     int nattr;
+    int interesting;
+    struct abbrev_skip *skip;
     struct abbrev_attr attr[0];
     };
 
+/* Return the size of FORM in DSO if it does not depend on the data,
+   else -1.  */
+
+static int
+form_size (DSO *dso, uint32_t form)
+    {
+    switch (form)
+        {
+        case DW_FORM_flag_present:
+            return 0;
+        case DW_FORM_addr:
+            return dso->ptr_size;
+        case DW_FORM_ref1:
+        case DW_FORM_flag:
+        case DW_FORM_data1:
+            return 1;
+        case DW_FORM_ref2:
+        case DW_FORM_data2:
+            return 2;
+        case DW_FORM_ref4:
+        case DW_FORM_data4:
+        case DW_FORM_sec_offset:
+        case DW_FORM_strp:
+            return 4;
+        case DW_FORM_ref8:
+        case DW_FORM_data8:
+        case DW_FORM_ref_sig8:
+            return 8;
+        default:
+            return -1;
+        }
+    }
+
+static ALWAYS_INLINE unsigned char *
+skip_form (DSO *dso, CU *cu, unsigned char *ptr, uint32_t form,
+           int big_endian)
+    {
+    uint64_t len = 0;
+    int size;
+
+    while (form == DW_FORM_indirect)
+        form = read_uleb128 (ptr, cu->end);
+
+    switch (form)
+        {
+        case DW_FORM_ref_addr:
+            if (cu->version == 2)
+                ptr += dso->ptr_size;
+            else
+                ptr += 4;
+            break;
+        case DW_FORM_sdata:
+        case DW_FORM_ref_udata:
+        case DW_FORM_udata:
+            skip_leb128 (ptr, cu->end);
+            break;
+        case DW_FORM_string:
+            ptr = (unsigned char *) strchr ((char *)ptr, '\0') + 1;
+            break;
+        case DW_FORM_block1:
+            len = *ptr++;
+            break;
+        case DW_FORM_block2:
+            len = buf_read_16 (ptr, big_endian);
+            ptr += 2;
+            break;
+        case DW_FORM_block4:
+            len = buf_read_32 (ptr, big_endian);
+            ptr += 4;
+            break;
+        case DW_FORM_block:
+        case DW_FORM_exprloc:
+            len = read_uleb128 (ptr, cu->end);
+            break;
+        default:
+            size = form_size (dso, form);
+            if (size < 0)
+                {
+                error (0, 0, "%s: Unknown DWARF DW_FORM_%d", dso->filename,
+                       form);
+                return NULL;
+                }
+            ptr += size;
+            break;
+        }
+
+    if (len != 0 && (ptr > cu->end || len > (uint64_t) (cu->end - ptr)))
+        {
+        error (0, 0, "%s: DWARF block runs past the end of its unit",
+               dso->filename);
+        return NULL;
+        }
+
+    return ptr + len;
+    }
+
+static ALWAYS_INLINE unsigned char *
+skip_attributes (DSO *dso, CU *cu, unsigned char *ptr, struct abbrev_tag *t,
+                 int big_endian)
+    {
+    struct abbrev_skip *s;
+
+    for (s = t->skip; ; ++s)
+        {
+        ptr += s->fixed;
+        if (s->form == 0)
+            return ptr;
+        ptr = skip_form (dso, cu, ptr, s->form, big_endian);
+        if (ptr == NULL)
+            return NULL;
+        }
+    }
+
+/* Append T's skip program to it, and note whether edit_attributes
+   needs to look at DIEs using it at all.  */
+
+static struct abbrev_tag *
+compile_abbrev (DSO *dso, struct abbrev_tag *t)
+    {
+    struct abbrev_tag *c;
+    struct abbrev_skip *s;
+    size_t attr_size = sizeof (*t) + t->nattr * sizeof (struct abbrev_attr);
+    int i, nsteps = 1;
+
+    t->interesting = 0;
+    for (i = 0; i < t->nattr; ++i)
+        {
+        if (form_size (dso, t->attr[i].form) < 0)
+            ++nsteps;
+        if (t->attr[i].attr == DW_AT_stmt_list
+                || t->attr[i].attr == DW_AT_comp_dir
+                || ((t->tag == DW_TAG_compile_unit
+                     || t->tag == DW_TAG_partial_unit)
+                    && t->attr[i].attr == DW_AT_name))
+            t->interesting = 1;
+        if (dso->rebuild_str && (t->attr[i].form == DW_FORM_strp
+                                 || t->attr[i].form == DW_FORM_indirect))
+            t->interesting = 1;
+        }
+
+    c = arena_alloc (&dso->arena, attr_size
+                                  + nsteps * sizeof (struct abbrev_skip));
+    if (c == NULL)
+        return NULL;
+    memcpy (c, t, attr_size);
+    t = c;
+
+    s = t->skip = (struct abbrev_skip *) ((char *) t + attr_size);
+    s->fixed = 0;
+    for (i = 0; i < t->nattr; ++i)
+        {
+        int size = form_size (dso, t->attr[i].form);
+
+        if (size >= 0)
+            s->fixed += size;
+        else
+            {
+            s->form = t->attr[i].form;
+            ++s;
+            s->fixed = 0;
+            }
+        }
+    s->form = 0;
+
+    return t;
+    }
+
 static hashval_t
 abbrev_hash (const void *p)
     {
@@ -293,68 +666,193 @@ abbrev_eq (const void *p, const void *q)
     return t1->entry == t2->entry;
     }
 
+/*
+ * Abbreviation codes are nearly always small and dense (1..N), so
+ * besides the hash table that owns the entries, a table whose codes
+ * are dense enough also gets an array indexed directly by code.
+ */
+
+/* The tags are indexed by code if the codes are dense enough, else
+   sorted by code.  Looking one up never writes to the table, as with
+   -j the CUs sharing it may be walked on several threads at once.  */
+
+struct abbrev_table
+    {
+    int dense;
+    unsigned int ntags;
+    struct abbrev_tag **tags;
+    };
+
+static int
+abbrev_fill (void **slot, void *data)
+    {
+    struct abbrev_table *table = (struct abbrev_table *)data;
+    struct abbrev_tag *t = (struct abbrev_tag *) *slot;
+
+    if (table->dense)
+        table->tags[t->entry] = t;
+    else
+        table->tags[table->ntags++] = t;
+    return 1;
+    }
+
+static int
+abbrev_entry_cmp (const void *a, const void *b)
+    {
+    const struct abbrev_tag *ta = *(const struct abbrev_tag **) a;
+    const struct abbrev_tag *tb = *(const struct abbrev_tag **) b;
+
+    return ta->entry < tb->entry ? -1 : ta->entry > tb->entry;
+    }
+
+/* Turn H, the tags read by read_abbrev, into a table, and delete it.
+   Returns NULL, leaving H alone, if out of memory.  */
+
+static struct abbrev_table *
+make_abbrev_table (htab_t h, unsigned int max_entry)
+    {
+    struct abbrev_table *table = malloc (sizeof (*table));
+    size_t n = htab_elements (h);
+
+    if (table == NULL)
+        return NULL;
+
+    table->dense = max_entry <= 2 * n + 16;
+    table->tags = calloc (table->dense ? max_entry + 1 : n,
+                          sizeof (struct abbrev_tag *));
+    if (table->tags == NULL)
+        {
+        free (table);
+        return NULL;
+        }
+    table->ntags = table->dense ? max_entry + 1 : 0;
+    htab_traverse (h, abbrev_fill, table);
+    if (!table->dense)
+        qsort (table->tags, table->ntags, sizeof (struct abbrev_tag *),
+               abbrev_entry_cmp);
+    htab_delete (h);
+
+    return table;
+    }
+
 static void
-abbrev_del (void *p)
+free_abbrev_table (struct abbrev_table *table)
     {
-    free (p);
+    free (table->tags);
+    free (table);
+    }
+
+static inline struct abbrev_tag *
+find_abbrev (struct abbrev_table *table, unsigned int entry)
+    {
+    unsigned int lo = 0, hi = table->ntags;
+
+    if (table->dense)
+        return entry < table->ntags ? table->tags[entry] : NULL;
+
+    while (lo < hi)
+        {
+        unsigned int mid = lo + (hi - lo) / 2;
+        struct abbrev_tag *t = table->tags[mid];
+
+        if (t->entry == entry)
+            return t;
+        if (t->entry < entry)
+            lo = mid + 1;
+        else
+            hi = mid;
+        }
+    return NULL;
     }
 
-static htab_t
+/* Read the abbreviation table at PTR.  Each tag is read into a scratch
+   buffer and then compiled into the DSO's arena, where it stays until
+   the abbrev cache is freed.  */
+
+static struct abbrev_table *
 read_abbrev (DSO *dso, unsigned char *ptr)
     {
-    htab_t h = htab_try_create (50, abbrev_hash, abbrev_eq, abbrev_del);
-    unsigned int attr, form;
-    struct abbrev_tag *t;
-    int size;
+    htab_t h = htab_try_create (50, abbrev_hash, abbrev_eq, NULL);
+    unsigned char *end = dso->debug_sections[DEBUG_ABBREV].data
+                         + dso->debug_sections[DEBUG_ABBREV].size;
+    struct abbrev_table *table;
+    uint64_t entry, tag, attr, form;
+    unsigned int max_entry = 0;
+    struct abbrev_tag *t, *scratch = NULL;
+    int size = 0;
     void **slot;
 
     if (h == NULL)
         {
 no_memory:
         error (0, ENOMEM, "%s: Could not read .debug_abbrev", dso->filename);
+        free (scratch);
         if (h)
             htab_delete (h);
         return NULL;
         }
 
-    while ((attr = read_uleb128 (ptr)) != 0)
+    while ((entry = read_uleb128 (ptr, end)) != 0)
         {
-        size = 10;
-        t = malloc (sizeof (*t) + size * sizeof (struct abbrev_attr));
-        if (t == NULL)
-            goto no_memory;
-        t->entry = attr;
+        tag = read_uleb128 (ptr, end);
+        if (entry > UINT_MAX || tag > UINT_MAX || ptr >= end)
+            {
+            error (0, 0, "%s: Invalid or truncated DWARF abbreviation",
+                   dso->filename);
+            free (scratch);
+            htab_delete (h);
+            return NULL;
+            }
+        if (scratch == NULL)
+            {
+            size = 10;
+            scratch = malloc (sizeof (*t) + size * sizeof (struct abbrev_attr));
+            if (scratch == NULL)
+                goto no_memory;
+            }
+        t = scratch;
+        t->entry = entry;
+        t->tag = tag;
         t->nattr = 0;
+        if (entry > max_entry)
+            max_entry = entry;
         slot = htab_find_slot (h, t, INSERT);
         if (slot == NULL)
-            {
-            free (t);
             goto no_memory;
-            }
         if (*slot != NULL)
             {
             error (0, 0, "%s: Duplicate DWARF abbreviation %d", dso->filename,
                    t->entry);
-            free (t);
+            free (scratch);
             htab_delete (h);
             return NULL;
             }
-        t->tag = read_uleb128 (ptr);
         ++ptr; /* skip children flag.  */
-        while ((attr = read_uleb128 (ptr)) != 0)
+        while ((attr = read_uleb128 (ptr, end)) != 0)
             {
+            if (attr > UINT_MAX)
+                {
+                error (0, 0, "%s: Invalid or truncated DWARF abbreviation",
+                       dso->filename);
+                free (scratch);
+                htab_delete (h);
+                return NULL;
+                }
             if (t->nattr == size)
                 {
-                size += 10;
+                size *= 2;
                 t = realloc (t, sizeof (*t) + size * sizeof (struct abbrev_attr));
                 if (t == NULL)
                     goto no_memory;
+                scratch = t;
                 }
-            form = read_uleb128 (ptr);
+            form = read_uleb128 (ptr, end);
             if (form == 2
                     || (form > DW_FORM_flag_present && form != DW_FORM_ref_sig8))
                 {
-                error (0, 0, "%s: Unknown DWARF DW_FORM_%d", dso->filename, form);
+                error (0, 0, "%s: Unknown DWARF DW_FORM_%llu", dso->filename,
+                       (unsigned long long) form);
+                free (scratch);
                 htab_delete (h);
                 return NULL;
                 }
@@ -362,17 +860,126 @@ no_memory:
             t->attr[t->nattr].attr = attr;
             t->attr[t->nattr++].form = form;
             }
-        if (read_uleb128 (ptr) != 0)
+        if (read_uleb128 (ptr, end) != 0)
             {
             error (0, 0, "%s: DWARF abbreviation does not end with 2 zeros",
                    dso->filename);
+            free (scratch);
             htab_delete (h);
             return NULL;
             }
+        t = compile_abbrev (dso, t);
+        if (t == NULL)
+            goto no_memory;
         *slot = t;
         }
+    free (scratch);
+    scratch = NULL;
 
-    return h;
+    table = make_abbrev_table (h, max_entry);
+    if (table == NULL)
+        goto no_memory;
+
+    return table;
+    }
+
+/*
+ * Parsed abbreviation tables are kept for the whole run over a DSO,
+ * keyed by their .debug_abbrev offset, since many CUs (LTO partitions,
+ * partial units, ...) share the same table.
+ */
+
+struct abbrev_cache_entry
+    {
+    uint32_t offset;
+    struct abbrev_table *abbrev;
+    };
+
+static hashval_t
+abbrev_cache_hash (const void *p)
+    {
+    struct abbrev_cache_entry *e = (struct abbrev_cache_entry *)p;
+
+    return e->offset;
+    }
+
+static int
+abbrev_cache_eq (const void *p, const void *q)
+    {
+    struct abbrev_cache_entry *e1 = (struct abbrev_cache_entry *)p;
+    struct abbrev_cache_entry *e2 = (struct abbrev_cache_entry *)q;
+
+    return e1->offset == e2->offset;
+    }
+
+static void
+abbrev_cache_del (void *p)
+    {
+    struct abbrev_cache_entry *e = (struct abbrev_cache_entry *)p;
+
+    free_abbrev_table (e->abbrev);
+    free (e);
+    }
+
+static struct abbrev_table *
+get_abbrev (DSO *dso, uint32_t offset)
+    {
+    struct abbrev_cache_entry key, *e;
+    void **slot;
+
+    if (dso->abbrev_cache == NULL)
+        {
+        dso->abbrev_cache = htab_try_create (50, abbrev_cache_hash,
+                                        abbrev_cache_eq, abbrev_cache_del);
+        if (dso->abbrev_cache == NULL)
+            goto no_memory;
+        }
+
+    key.offset = offset;
+    e = htab_find_with_hash (dso->abbrev_cache, &key, offset);
+    if (e != NULL)
+        {
+        dso->stats.abbrev_hits++;
+        return e->abbrev;
+        }
+
+    dso->stats.abbrev_misses++;
+    e = malloc (sizeof (*e));
+    if (e == NULL)
+        goto no_memory;
+    e->offset = offset;
+    e->abbrev = read_abbrev (dso, dso->debug_sections[DEBUG_ABBREV].data + offset);
+    if (e->abbrev == NULL)
+        {
+        free (e);
+        return NULL;
+        }
+
+    slot = htab_find_slot_with_hash (dso->abbrev_cache, e, offset, INSERT);
+    if (slot == NULL)
+        {
+        abbrev_cache_del (e);
+        goto no_memory;
+        }
+    *slot = e;
+
+    return e->abbrev;
+
+no_memory:
+    error (0, ENOMEM, "%s: Could not read .debug_abbrev", dso->filename);
+    return NULL;
+    }
+
+static void
+free_abbrev_cache (DSO *dso)
+    {
+    if (dso->abbrev_cache != NULL)
+        htab_delete (dso->abbrev_cache);
+    dso->abbrev_cache = NULL;
+    dso->stats.arena_allocs += dso->arena.nallocs;
+    dso->stats.arena_blocks += dso->arena.nblocks;
+    arena_release (&dso->arena);
+    memset (&dso->arena, 0, sizeof (dso->arena));
     }
 
 #define IS_DIR_SEPARATOR(c) ((c)=='/')
@@ -382,6 +989,17 @@ canonicalize_path (const char *s, char *d)
     {
     char *rv = d;
     char *droot;
+    const char *run;
+
+    /* Most paths are canonical already: nothing but single separators
+       between segments not starting with a dot, and no trailing one.  */
+    run = find_slash_run (s);
+    if (*run == '\0' && run != s && *s != '.' && !IS_DIR_SEPARATOR (run[-1]))
+        {
+        if (d != s)
+            memmove (d, s, run - s + 1);
+        return rv;
+        }
 
     if (IS_DIR_SEPARATOR (*s))
         {
@@ -465,54 +1083,72 @@ canonicalize_path (const char *s, char *d)
     return rv;
     }
 
-static int
-has_prefix (const char  *str,
-            const char  *prefix)
+/* The rule to rewrite STR with: the one with the longest base dir STR
+   starts with, if that has a dest dir.  */
+
+static const struct path_rule *
+find_rewrite (const char *str)
     {
-    size_t str_len;
-    size_t prefix_len;
+    const struct path_rule *r;
 
-    str_len = strlen (str);
-    prefix_len = strlen (prefix);
+    if (!rewrite_paths)
+        return NULL;
+    r = pathmap_match (path_map, str);
+    return r != NULL && r->dest != NULL ? r : NULL;
+    }
 
-    if (str_len < prefix_len)
-        return 0;
+/* The part of path S to report in the list file: S without the base
+   dir, or without the dest dir if it was already rewritten.  NULL if S
+   is under none of them.  */
 
-    return strncmp (str, prefix, prefix_len) == 0;
+static const char *
+list_path (const char *s)
+    {
+    const struct path_rule *r;
+
+    if (path_map == NULL)
+        return s;
+    if ((r = pathmap_match (path_map, s)) != NULL)
+        return s + r->base_len;
+    if ((r = pathmap_match_dest (path_map, s)) != NULL)
+        return s + r->dest_len;
+    return NULL;
     }
 
-static int dirty_elf;
 static void
-dirty_section (unsigned int sec)
+dirty_section (DSO *dso, unsigned int sec)
+    {
+    elf_flagdata (dso->debug_sections[sec].elf_data, ELF_C_SET, ELF_F_DIRTY);
+    dso->dirty_elf = 1;
+    }
+
+/* With -m the file is edited through pointers into its mapping, so
+   only data that libelf hands out from the mapping itself, rather than
+   from a converted copy of its own, can be edited.  */
+
+static int
+data_in_map (DSO *dso, Elf_Data *data)
     {
-    elf_flagdata (debug_sections[sec].elf_data, ELF_C_SET, ELF_F_DIRTY);
-    dirty_elf = 1;
+    unsigned char *map = (unsigned char *) dso->map;
+    unsigned char *buf = (unsigned char *) data->d_buf;
+
+    return dso->map == NULL
+           || (buf >= map && buf + data->d_size <= map + dso->map_size);
     }
 
 void make_win_path(char * path)
     {
-    int k = 0;
-    while (path[k] != '\0')
-        {
-        if (path[k] == '/') path[k] = '\\';
-        k++;
-        }
+    path_to_win (path);
     }
 
 #define LST_FILE 0
 #define LST_DIR 1
 
 static int
-append_list_file(char *p, int type)
+write_list_file (const char *p, size_t size)
     {
-    size_t size = strlen (p) + 1;
-    ssize_t ret;
+    ssize_t ret = 0;
 
-    if (list_only_files != 0 && type != LST_FILE)
-        return (0);
-    ret = 0;
-    if (use_newline != 0)
-        p[size - 1] = '\n';
     while (size > 0)
         {
         ret = write (list_file_fd, p, size);
@@ -520,32 +1156,399 @@ append_list_file(char *p, int type)
             break;
         size -= ret;
         p += ret;
-    }
-    if (use_newline != 0)
-        p[size - 1] = '\0';
+        }
     return (ret < 0 ? -1 : 0);
     }
 
+/* Append SIZE bytes at P to LIST.  */
+
+static void
+list_append (LIST *list, const char *p, size_t size)
+    {
+    if (list->len + size > list->size)
+        {
+        list->size = 2 * (list->len + size);
+        list->buf = realloc (list->buf, list->size);
+        if (list->buf == NULL)
+            error (1, errno, "Could not allocate memory");
+        }
+    memcpy (list->buf + list->len, p, size);
+    list->len += size;
+    }
+
+/* Add P to the list file output collected in LIST.  */
+
+static int
+append_list_file(LIST *list, const char *p, int type)
+    {
+    char sep = use_newline ? '\n' : '\0';
+
+    if (list_only_files != 0 && type != LST_FILE)
+        return (0);
+
+    list_append (list, p, strlen (p));
+    list_append (list, &sep, 1);
+    return 0;
+    }
+
+/*
+ * The list file is written through one buffer for the whole run, and
+ * each path only the first time any file reports it.  With --sort-list
+ * the paths are all held back and written sorted at the end instead.
+ */
+
+#define LIST_FLUSH_SIZE (256 * 1024)
+
+static LIST list_out;
+static htab_t list_seen;
+
+struct list_key
+    {
+    const char *p;
+    size_t len;
+    };
+
+static hashval_t
+list_path_hash (const char *p, size_t len)
+    {
+    hashval_t h = 0;
+
+    while (len-- > 0)
+        h = h * 67 + *(const unsigned char *) p++ - 113;
+    return h;
+    }
+
+static hashval_t
+list_seen_hash (const void *p)
+    {
+    return list_path_hash ((const char *) p, strlen ((const char *) p));
+    }
+
+static int
+list_seen_eq (const void *p, const void *q)
+    {
+    const char *s = (const char *) p;
+    const struct list_key *k = (const struct list_key *) q;
+
+    return strncmp (s, k->p, k->len) == 0 && s[k->len] == '\0';
+    }
+
+static void
+flush_list_file (void)
+    {
+    if (list_out.len && write_list_file (list_out.buf, list_out.len) < 0)
+        error (0, errno, "Could not write list file %s", list_file);
+    list_out.len = 0;
+    }
+
+/* Queue the paths in the LEN bytes at BUF, as collected by
+   append_list_file, for the list file.  */
+
+static void
+emit_list (const char *buf, size_t len)
+    {
+    char sep = use_newline ? '\n' : '\0';
+    const char *end = buf + len, *e;
+    struct list_key key;
+    void **slot;
+
+    if (list_seen == NULL)
+        {
+        list_seen = htab_try_create (1024, list_seen_hash, list_seen_eq,
+                                     free);
+        if (list_seen == NULL)
+            error (1, ENOMEM, "Could not allocate memory");
+        }
+
+    for (; buf < end; buf = e + 1)
+        {
+        e = memchr (buf, sep, end - buf);
+        if (e == NULL)
+            e = end;
+        key.p = buf;
+        key.len = e - buf;
+        slot = htab_find_slot_with_hash (list_seen, &key,
+                                         list_path_hash (buf, key.len),
+                                         INSERT);
+        if (slot == NULL)
+            error (1, ENOMEM, "Could not allocate memory");
+        if (*slot != NULL)
+            continue;
+        *slot = strndup (buf, key.len);
+        if (*slot == NULL)
+            error (1, errno, "Could not allocate memory");
+
+        if (!sort_list)
+            {
+            list_append (&list_out, buf, key.len);
+            list_append (&list_out, &sep, 1);
+            if (list_out.len >= LIST_FLUSH_SIZE)
+                flush_list_file ();
+            }
+        }
+    }
+
+static int
+list_seen_collect (void **slot, void *data)
+    {
+    char ***next = (char ***) data;
+
+    *(*next)++ = (char *) *slot;
+    return 1;
+    }
+
+static int
+list_path_cmp (const void *a, const void *b)
+    {
+    return strcmp (*(char *const *) a, *(char *const *) b);
+    }
+
+/* Write out whatever the list file is still owed.  */
+
+static void
+finish_list_file (void)
+    {
+    char sep = use_newline ? '\n' : '\0';
+
+    if (list_seen != NULL && sort_list)
+        {
+        size_t i, n = htab_elements (list_seen);
+        char **paths = malloc ((n + 1) * sizeof (char *)), **next = paths;
+
+        if (paths == NULL)
+            error (1, errno, "Could not allocate memory");
+        htab_traverse (list_seen, list_seen_collect, &next);
+        qsort (paths, n, sizeof (char *), list_path_cmp);
+        for (i = 0; i < n; ++i)
+            {
+            list_append (&list_out, paths[i], strlen (paths[i]));
+            list_append (&list_out, &sep, 1);
+            if (list_out.len >= LIST_FLUSH_SIZE)
+                flush_list_file ();
+            }
+        free (paths);
+        }
+    flush_list_file ();
+
+    if (list_seen != NULL)
+        htab_delete (list_seen);
+    list_seen = NULL;
+    free (list_out.buf);
+    memset (&list_out, 0, sizeof (list_out));
+    }
+
+/*
+ * The file names of a line table are relative to one of its directories
+ * and maybe to the unit's comp_dir, all kept inline in the table, so the
+ * same combinations are spelled out again in every unit including the
+ * same headers.  The list file path each joined name canonicalizes to
+ * is cached by the joined name, for all the units of a DSO, in a set
+ * the line jobs share across threads.
+ */
+
+struct path_cache_entry
+    {
+    hashval_t hash;
+    size_t len;
+    /* Where the list file path starts in RAW, or -1 if it is not
+       listed.  RAW holds the joined name and then its canonical form.  */
+    ssize_t list;
+    char raw[0];
+    };
+
+static hashval_t
+path_cache_hash (const void *p)
+    {
+    return ((const struct path_cache_entry *) p)->hash;
+    }
+
+static int
+path_cache_eq (const void *p, const void *q)
+    {
+    const struct path_cache_entry *e = (const struct path_cache_entry *) p;
+    const struct list_key *k = (const struct list_key *) q;
+
+    return e->len == k->len && memcmp (e->raw, k->p, k->len) == 0;
+    }
+
+/* The list file path of FILE from directory DIR of the line table of a
+   unit in COMP_DIR, or NULL if it is not listed.  SCRATCH is a buffer to
+   join them in.  The lookup is counted in JOB.  */
+
+static const char *
+list_file_path (DSO *dso, LINE_JOB *job, LIST *scratch, const char *comp_dir,
+                const char *dir, const char *file)
+    {
+    struct path_cache_entry *e, *found;
+    struct list_key key;
+    hashval_t hash;
+    const char *p;
+
+    scratch->len = 0;
+    if (*file != '/')
+        {
+        if (*dir != '/' && *comp_dir != '\0')
+            {
+            list_append (scratch, comp_dir, strlen (comp_dir));
+            list_append (scratch, "/", 1);
+            }
+        list_append (scratch, dir, strlen (dir));
+        list_append (scratch, "/", 1);
+        }
+    list_append (scratch, file, strlen (file) + 1);
+
+    key.p = scratch->buf;
+    key.len = scratch->len - 1;
+    hash = list_path_hash (key.p, key.len);
+
+    e = chtab_find (dso->path_cache, &key, hash);
+    if (e != NULL)
+        {
+        job->path_hits++;
+        return e->list < 0 ? NULL : e->raw + e->list;
+        }
+
+    e = malloc (sizeof (*e) + 2 * scratch->len);
+    if (e == NULL)
+        error (1, errno, "%s: Could not allocate memory", dso->filename);
+    e->hash = hash;
+    e->len = key.len;
+    memcpy (e->raw, key.p, scratch->len);
+    canonicalize_path (e->raw, e->raw + scratch->len);
+    p = list_path (e->raw + scratch->len);
+    e->list = p == NULL ? -1 : p - e->raw;
+
+    found = chtab_insert (dso->path_cache, &key, hash, e);
+    if (found == NULL)
+        error (1, ENOMEM, "%s: Could not allocate memory", dso->filename);
+    if (found == e)
+        job->path_misses++;
+    else
+        {
+        /* Another thread got there first.  */
+        free (e);
+        e = found;
+        job->path_hits++;
+        }
+
+    return e->list < 0 ? NULL : e->raw + e->list;
+    }
+
+/*
+ * When dest dir is longer than base dir the directory and file tables
+ * no longer fit, so the line table starting at START is rewritten into
+ * a new buffer for rebuild_debug_line instead, with its unit and header
+ * lengths adjusted.  DIR is the start of the directory table, TABLES_END
+ * the end of the file table.  The entries are rewritten just as they
+ * would have been in place, but without any padding.
+ */
+
+static int
+rebuild_line_table (DSO *dso, LINE_JOB *job, unsigned char *start,
+                    unsigned char *dir, unsigned char *tables_end,
+                    unsigned char *endcu)
+    {
+    const struct path_rule *r;
+    size_t nstrings = 0, size;
+    unsigned char *buf, *p, *src, *attrs;
+    int32_t delta;
+
+    for (src = dir; src < tables_end; ++src)
+        if (*src == '\0')
+            ++nstrings;
+
+    buf = malloc ((endcu - start) + nstrings * max_dest_len);
+    if (buf == NULL)
+        error (1, errno, "%s: Could not allocate memory", dso->filename);
+
+    memcpy (buf, start, dir - start);
+    p = buf + (dir - start);
+
+    for (src = dir; *src != 0; src += strlen ((char *) src) + 1)
+        {
+        const char *readptr = (const char *) src;
+
+        if (*src == '/' && (r = find_rewrite ((char *) src)) != NULL)
+            {
+            memcpy (p, r->dest, r->dest_len);
+            p += r->dest_len;
+            readptr += r->base_len;
+            }
+        canonicalize_path (readptr, (char *) p);
+        if (win_path)
+            make_win_path((char *) p);
+        p += strlen ((char *) p) + 1;
+        }
+    *p++ = *src++;
+
+    while (*src != 0)
+        {
+        size_t len = strlen ((char *) src) + 1;
+
+        if (*src == '/' && (r = find_rewrite ((char *) src)) != NULL)
+            {
+            memcpy (p, r->dest, r->dest_len);
+            memcpy (p + r->dest_len, src + r->base_len, len - r->base_len);
+            p += r->dest_len + len - r->base_len;
+            }
+        else
+            {
+            memcpy (p, src, len);
+            p += len;
+            }
+        src += len;
+
+        attrs = src;
+        skip_leb128 (src, tables_end);
+        skip_leb128 (src, tables_end);
+        skip_leb128 (src, tables_end);
+        memcpy (p, attrs, src - attrs);
+        p += src - attrs;
+        }
+    *p++ = *src++;
+
+    memcpy (p, src, endcu - src);
+    p += endcu - src;
+    size = p - buf;
+
+    if (size == (size_t) (endcu - start) && memcmp (buf, start, size) == 0)
+        {
+        free (buf);
+        return 0;
+        }
+
+    /* unit_length, and header_length after the 2 byte version.  */
+    delta = size - (endcu - start);
+    dso->write_32 (buf, size - 4);
+    dso->write_32 (buf + 6, dso->do_read_32 (start + 6) + delta);
+
+    free (job->line);
+    job->line = buf;
+    job->line_len = size;
+    return 0;
+    }
+
 static int
-edit_dwarf2_line (DSO *dso, uint32_t off, char *comp_dir, int phase)
+edit_dwarf2_line (DSO *dso, LINE_JOB *job)
     {
-    unsigned char *ptr = debug_sections[DEBUG_LINE].data, *dir;
+    uint32_t off = job->list_offs;
+    char *comp_dir = job->comp_dir;
+    unsigned char *ptr = dso->debug_sections[DEBUG_LINE].data, *dir, *start;
     unsigned char **dirt;
-    unsigned char *endsec = ptr + debug_sections[DEBUG_LINE].size;
+    unsigned char *endsec = ptr + dso->debug_sections[DEBUG_LINE].size;
     unsigned char *endcu, *endprol;
     unsigned char opcode_base;
     uint32_t value, dirt_cnt;
-    size_t comp_dir_len = strlen (comp_dir);
-    size_t abs_file_cnt = 0, abs_dir_cnt = 0;
-
-    if (phase != 0)
-        return 0;
+    LIST scratch = { NULL, 0, 0 };
+    size_t abs_file_shrink = 0, abs_dir_shrink = 0;
+    const struct path_rule *r;
 
     /* XXX: RhBug:929365, should we error out instead of ignoring? */
     if (ptr == NULL)
         return 0;
 
     ptr += off;
+    start = ptr;
 
     /* 
      * unit_length 
@@ -555,7 +1558,7 @@ edit_dwarf2_line (DSO *dso, uint32_t off, char *comp_dir, int phase)
      */
 
     endcu = ptr + 4;
-    endcu += read_32 (ptr); 
+    endcu += read_32 (dso, ptr); 
     if (endcu == ptr + 0xffffffff)
         {
         error (0, 0, "%s: 64-bit DWARF not supported", dso->filename);
@@ -576,7 +1579,7 @@ edit_dwarf2_line (DSO *dso, uint32_t off, char *comp_dir, int phase)
      * information and is independent of the DWARF version number.
      */
      
-    value = read_16 (ptr);
+    value = read_16 (dso, ptr);
     if (value != 2 && value != 3 && value != 4)
         {
         error (0, 0, "%s: DWARF version %d unhandled", dso->filename,
@@ -595,7 +1598,7 @@ edit_dwarf2_line (DSO *dso, uint32_t off, char *comp_dir, int phase)
      */
      
     endprol = ptr + 4;
-    endprol += read_32 (ptr);
+    endprol += read_32 (dso, ptr);
     if (endprol > endcu)
         {
         error (0, 0, "%s: .debug_line CU prologue does not fit into CU",
@@ -637,17 +1640,17 @@ edit_dwarf2_line (DSO *dso, uint32_t off, char *comp_dir, int phase)
     /* file table: */
     while (*ptr != 0)
         {
-        char *s, *file;
-        size_t file_len, dir_len;
+        char *file;
 
         file = (char *) ptr;
         ptr = (unsigned char *) strchr ((char *)ptr, 0) + 1;
-        value = read_uleb128 (ptr);
+        value = read_uleb128 (ptr, endprol);
 
         if (value >= dirt_cnt)
             {
             error (0, 0, "%s: Wrong directory table index %u",
                    dso->filename, value);
+            free (scratch.buf);
             return 1;
             }
 
@@ -655,83 +1658,43 @@ edit_dwarf2_line (DSO *dso, uint32_t off, char *comp_dir, int phase)
         if (strcmp(file, "<built-in>") == 0)
             goto skip;
 
-        file_len = strlen (file);
-        dir_len = strlen ((char *)dirt[value]);
-        s = malloc (comp_dir_len + 1 + file_len + 1 + dir_len + 1);
-        if (s == NULL)
-            {
-            error (0, ENOMEM, "%s: Reading file table", dso->filename);
-            return 1;
-            }
-        
         if (*file == '/')
             {
-            memcpy (s, file, file_len + 1);
-            if (dest_dir && has_prefix (file, base_dir))
-                ++abs_file_cnt;
-            }
-        else if (*dirt[value] == '/')
-            {
-            memcpy (s, dirt[value], dir_len);
-            s[dir_len] = '/';
-            memcpy (s + dir_len + 1, file, file_len + 1);
-            }
-        else
-            {
-            char *p = s;
-            if (comp_dir_len != 0)
-                {
-                memcpy (s, comp_dir, comp_dir_len);
-                s[comp_dir_len] = '/';
-                p += comp_dir_len + 1;
-                }
-            memcpy (p, dirt[value], dir_len);
-            p[dir_len] = '/';
-            memcpy (p + dir_len + 1, file, file_len + 1);
+            r = find_rewrite (file);
+            if (r != NULL && r->dest_len < r->base_len)
+                abs_file_shrink += r->base_len - r->dest_len;
             }
         
-        fprintf(debug_fd, "@@@@linedirt[%d] %s\n", value, dirt[value]);
+        TRACE (2, "@@@@linedirt[%d] %s\n", value, dirt[value]);
         
-        canonicalize_path (s, s);
-                
         if (list_file_fd != -1)
             {
-            char *p = NULL;
-            if (base_dir == NULL)
-                p = s;
-            else if (has_prefix (s, base_dir))
-                p = s + strlen (base_dir);
-            else if (has_prefix (s, dest_dir))
-                p = s + strlen (dest_dir);
+            const char *p = list_file_path (dso, job, &scratch, comp_dir,
+                                            (char *) dirt[value], file);
 
             if (p)
                 {
-                append_list_file(p, LST_FILE);
+                append_list_file(&job->list, p, LST_FILE);
                 }
             }
 
-        if (win_path)
-            make_win_path(s);
-
-        free (s);
-
 skip:
-        read_uleb128 (ptr);
-        read_uleb128 (ptr);
+        skip_leb128 (ptr, endprol);
+        skip_leb128 (ptr, endprol);
         }
     ++ptr;
+    free (scratch.buf);
 
-    if (dest_dir)
+    if (rewrite_paths && dso->rebuild_line)
+        return rebuild_line_table (dso, job, start, dir, ptr, endcu);
+
+    if (rewrite_paths)
         {
         unsigned char *srcptr, *buf = NULL;
-        size_t base_len = strlen (base_dir);
-        size_t dest_len = strlen (dest_dir);
         size_t shrank = 0;
+        struct arena scratch_arena = { NULL, NULL, NULL, NULL, 0, 0 };
 
-        if (dest_len == base_len)
-            abs_file_cnt = 0;
-        
-        if (abs_file_cnt)
+        if (abs_file_shrink)
             {
             srcptr = buf = malloc (ptr - dir);
             memcpy (srcptr, dir, ptr - dir);
@@ -745,17 +1708,22 @@ skip:
             size_t len = strlen ((char *)srcptr) + 1;
             const unsigned char *readptr = srcptr;
 
-            char *orig = strdup ((const char *) srcptr);
+            char *orig;
+
+            arena_reset (&scratch_arena);
+            orig = arena_strdup (&scratch_arena, (const char *) srcptr);
+            if (orig == NULL)
+                error (1, ENOMEM, "%s: Could not allocate memory",
+                       dso->filename);
             
-            fprintf(debug_fd, "####linesrcptr %s\n", srcptr);
+            TRACE (2, "####linesrcptr %s\n", srcptr);
 
-            if (*srcptr == '/' && has_prefix ((char *)srcptr, base_dir))
+            if (*srcptr == '/' && (r = find_rewrite ((char *)srcptr)) != NULL)
                 {
-                if (dest_len < base_len)
-                    ++abs_dir_cnt;
-                memcpy (ptr, dest_dir, dest_len);
-                ptr += dest_len;
-                readptr += base_len;
+                abs_dir_shrink += r->base_len - r->dest_len;
+                memcpy (ptr, r->dest, r->dest_len);
+                ptr += r->dest_len;
+                readptr += r->base_len;
                 }
             
             srcptr += len;
@@ -772,9 +1740,11 @@ skip:
             ptr += len;
 
             if (memcmp (orig, ptr - len, len))
-                dirty_section (DEBUG_STR);
-            free (orig);
+                job->dirty |= 1 << DEBUG_LINE;
             }
+        arena_release (&scratch_arena);
+        job->arena_allocs = scratch_arena.nallocs;
+        job->arena_blocks = scratch_arena.nblocks;
 
         if (shrank > 0)
             {
@@ -789,9 +1759,9 @@ skip:
                 }
             }
 
-        if (abs_dir_cnt + abs_file_cnt != 0)
+        if (abs_dir_shrink + abs_file_shrink != 0)
             {
-            size_t len = (abs_dir_cnt + abs_file_cnt) * (base_len - dest_len);
+            size_t len = abs_dir_shrink + abs_file_shrink;
 
             if (len == 1)
                 error (EXIT_FAILURE, 0, "-b arg has to be either the same length as -d arg, or more than 1 char longer");
@@ -806,29 +1776,29 @@ skip:
             {
             size_t len = strlen ((char *)srcptr) + 1;
 
-            fprintf(debug_fd, "@@@@line srcptr %s\n", srcptr);
+            TRACE (2, "@@@@line srcptr %s\n", srcptr);
             
-            if (*srcptr == '/' && has_prefix ((char *)srcptr, base_dir))
+            if (*srcptr == '/' && (r = find_rewrite ((char *)srcptr)) != NULL)
                 {
-                memcpy (ptr, dest_dir, dest_len);
-                if (dest_len < base_len)
-                    {
-                    memmove (ptr + dest_len, srcptr + base_len,
-                             len - base_len);
-                    ptr += dest_len - base_len;
-                    }
-                dirty_section (DEBUG_STR);
+                memcpy (ptr, r->dest, r->dest_len);
+                memmove (ptr + r->dest_len, srcptr + r->base_len,
+                         len - r->base_len);
+                ptr += r->dest_len + len - r->base_len;
+                job->dirty |= 1 << DEBUG_LINE;
+                }
+            else
+                {
+                if (ptr != srcptr)
+                    memmove (ptr, srcptr, len);
+                ptr += len;
                 }
-            else if (ptr != srcptr)
-                memmove (ptr, srcptr, len);
             
             srcptr += len;
-            ptr += len;
             dir = srcptr;
             
-            read_uleb128 (srcptr);
-            read_uleb128 (srcptr);
-            read_uleb128 (srcptr);
+            skip_leb128 (srcptr, endprol);
+            skip_leb128 (srcptr, endprol);
+            skip_leb128 (srcptr, endprol);
             
             if (ptr != dir)
                 memmove (ptr, dir, srcptr - dir);
@@ -842,308 +1812,1362 @@ skip:
     return 0;
     }
 
-static unsigned char *
-edit_attributes (DSO *dso, unsigned char *ptr, struct abbrev_tag *t, int phase)
+/*
+ * Rewrites of DW_AT_comp_dir and DW_AT_name are not done while walking
+ * .debug_info.  A later CU may share the same .debug_str string, and it
+ * must still see the original one when its line table is edited, so the
+ * rewrites are queued on each CU and replayed in CU order by
+ * apply_patches once all the line tables have been edited.
+ */
+
+#define PATCH_COMP_DIR 0
+#define PATCH_NAME 1
+#define PATCH_END_DIE 2
+
+static void
+queue_patch (DSO *dso, CU *cu, int kind, unsigned int form, char *str)
     {
-    int i;
-    uint32_t list_offs;
-    int found_list_offs;
-    char *comp_dir;
+    if (cu->npatches == cu->max_patches)
+        {
+        cu->max_patches = cu->max_patches ? 2 * cu->max_patches : 8;
+        cu->patches = realloc (cu->patches, cu->max_patches * sizeof (PATCH));
+        if (cu->patches == NULL)
+            error (1, errno, "%s: Could not allocate memory", dso->filename);
+        }
+    cu->patches[cu->npatches].kind = kind;
+    cu->patches[cu->npatches].form = form;
+    cu->patches[cu->npatches].str = str;
+    cu->npatches++;
+    }
 
-    comp_dir = NULL;
-    list_offs = 0;
-    found_list_offs = 0;
-    for (i = 0; i < t->nattr; ++i)
+/* Note that the OFFSET into SEC at PTR has to be remapped.  */
+
+static void
+queue_fixup (DSO *dso, CU *cu, unsigned char *ptr, uint32_t offset, int sec)
+    {
+    if (cu->nfixups == cu->max_fixups)
         {
-        uint32_t form = t->attr[i].form;
-        size_t len = 0;
-        size_t base_len, dest_len;
+        cu->max_fixups = cu->max_fixups ? 2 * cu->max_fixups : 16;
+        cu->fixups = realloc (cu->fixups, cu->max_fixups * sizeof (FIXUP));
+        if (cu->fixups == NULL)
+            error (1, errno, "%s: Could not allocate memory", dso->filename);
+        }
+    cu->fixups[cu->nfixups].ptr = ptr;
+    cu->fixups[cu->nfixups].offset = offset;
+    cu->fixups[cu->nfixups].sec = sec;
+    cu->nfixups++;
+    }
 
-        while (1)
-            {
-            if (t->attr[i].attr == DW_AT_stmt_list)
-                {
-                if (form == DW_FORM_data4
-                        || form == DW_FORM_sec_offset)
-                    {
-                    list_offs = do_read_32_relocated (ptr);
-                    found_list_offs = 1;
-                    }
-                }
+static LINE_JOB *
+new_line_job (DSO *dso, CU *cu)
+    {
+    LINE_JOB *job;
 
-            if (t->attr[i].attr == DW_AT_comp_dir)
-                {
-                if (form == DW_FORM_string)
-                    {
-                    free (comp_dir);
-                    comp_dir = strdup ((char *)ptr);
-                    
-                    fprintf(debug_fd, "####1comp_dir %s\n", comp_dir);
-                    
-                    if (phase == 1 && dest_dir && has_prefix ((char *)ptr, base_dir))
-                        {
-                        base_len = strlen (base_dir);
-                        dest_len = strlen (dest_dir);
-                        
-                        fprintf(debug_fd, "####1updating base from %s to %s\n", base_dir, dest_dir);
+    if (cu->njobs == cu->max_jobs)
+        {
+        cu->max_jobs = cu->max_jobs ? 2 * cu->max_jobs : 1;
+        cu->jobs = realloc (cu->jobs, cu->max_jobs * sizeof (LINE_JOB));
+        if (cu->jobs == NULL)
+            error (1, errno, "%s: Could not allocate memory", dso->filename);
+        }
+    job = &cu->jobs[cu->njobs++];
+    memset (job, 0, sizeof (*job));
+    return job;
+    }
 
-                        memcpy (ptr, dest_dir, dest_len);
-                        if (dest_len < base_len)
-                            {
-                            if (win_path)
-                                memset(ptr + dest_len, '\\',
-                                       base_len - dest_len);
-                            else
-                                memset(ptr + dest_len, '/',
-                                       base_len - dest_len);
+/* 
+ * If the compile unit has full path from root '/', and the compilation
+ * directory is still null, then we construct a compilation directory
+ * string by removing the file name from the compile unit name attribute.
+ */
 
-                            }
-                        dirty_section (DEBUG_INFO);
-                        }
-                    }
-                else if (form == DW_FORM_strp &&
-                         debug_sections[DEBUG_STR].data)
-                    {
-                    char *dir;
+static char *
+comp_dir_from_name (DSO *dso, CU *cu, const char *name)
+    {
+    char *comp_dir;
+    const char *enddir = strrchr (name, '/');
 
-                    dir = (char *) debug_sections[DEBUG_STR].data
-                          + do_read_32_relocated (ptr);
+    if (enddir == name)
+        enddir++;
 
-                    free (comp_dir);
-                    comp_dir = strdup (dir);
+    comp_dir = arena_alloc (&cu->arena, enddir - name + 1);
+    if (comp_dir == NULL)
+        error (1, ENOMEM, "%s: Could not allocate memory", dso->filename);
+    memcpy (comp_dir, name, enddir - name);
+    comp_dir [enddir - name] = '\0';
+    return comp_dir;
+    }
 
-                    fprintf(debug_fd, "####2comp_dir %s\n", comp_dir);
+/* A copy of comp_dir DIR, kept with CU.  */
 
-                    if (phase == 1 && dest_dir && has_prefix (dir, base_dir))
-                        {
-                        base_len = strlen (base_dir);
-                        dest_len = strlen (dest_dir);
+static char *
+cu_strdup (DSO *dso, CU *cu, const char *dir)
+    {
+    char *s = arena_strdup (&cu->arena, dir);
 
-                        fprintf(debug_fd, "####2updating base from %s to %s\n", base_dir, dest_dir);
+    if (s == NULL)
+        error (1, ENOMEM, "%s: Could not allocate memory", dso->filename);
+    return s;
+    }
 
-                        memcpy (dir, dest_dir, dest_len);
-                        if (dest_len < base_len)
-                            {
-                            memmove (dir + dest_len, dir + base_len,
-                                     strlen (dir + base_len) + 1);
-                            }
-                        dirty_section (DEBUG_STR);
-                        }
-                    }
-                }
-            else if ((t->tag == DW_TAG_compile_unit
-                      || t->tag == DW_TAG_partial_unit)
-                     && t->attr[i].attr == DW_AT_name)
+/* Report the directory of a unit DIE into the list file.  */
+
+static void
+list_comp_dir (LIST *list, char *comp_dir)
+    {
+    const char *p = list_path (comp_dir);
+
+    if (p == NULL)
+        p = comp_dir;
+
+    append_list_file(list, p, LST_DIR);
+    }
+
+/*
+ * With a rebuilt .debug_str the unit strings are not edited in place;
+ * their replacements are kept by offset until the new table is laid
+ * out, and whoever looks at a string afterwards sees the replacement,
+ * just as it would see the edited bytes.
+ */
+
+struct str_rewrite
+    {
+    uint32_t offset;
+    char *str;
+    };
+
+static hashval_t
+str_rewrite_hash (const void *p)
+    {
+    return ((const struct str_rewrite *) p)->offset;
+    }
+
+static int
+str_rewrite_eq (const void *p, const void *q)
+    {
+    return ((const struct str_rewrite *) p)->offset
+           == ((const struct str_rewrite *) q)->offset;
+    }
+
+static void
+str_rewrite_del (void *p)
+    {
+    free (((struct str_rewrite *) p)->str);
+    free (p);
+    }
+
+/* The current contents of the .debug_str string at OFFSET.  */
+
+static char *
+current_str (DSO *dso, uint32_t offset)
+    {
+    struct str_rewrite key, *r = NULL;
+
+    key.offset = offset;
+    if (dso->str_rewrites != NULL)
+        r = htab_find_with_hash (dso->str_rewrites, &key, offset);
+    if (r != NULL)
+        return r->str;
+    return (char *) dso->debug_sections[DEBUG_STR].data + offset;
+    }
+
+static void
+rewrite_str (DSO *dso, uint32_t offset, char *str)
+    {
+    struct str_rewrite *r, key;
+    void **slot;
+
+    if (dso->str_rewrites == NULL)
+        {
+        dso->str_rewrites = htab_try_create (16, str_rewrite_hash,
+                                             str_rewrite_eq,
+                                             str_rewrite_del);
+        if (dso->str_rewrites == NULL)
+            error (1, ENOMEM, "%s: Could not allocate memory", dso->filename);
+        }
+
+    key.offset = offset;
+    slot = htab_find_slot_with_hash (dso->str_rewrites, &key, offset, INSERT);
+    if (slot == NULL)
+        error (1, ENOMEM, "%s: Could not allocate memory", dso->filename);
+    if (*slot != NULL)
+        {
+        r = (struct str_rewrite *) *slot;
+        free (r->str);
+        }
+    else
+        {
+        r = malloc (sizeof (*r));
+        if (r == NULL)
+            error (1, errno, "%s: Could not allocate memory", dso->filename);
+        r->offset = offset;
+        *slot = r;
+        }
+    r->str = str;
+    }
+
+/* Replace the base dir of rule R that STR starts with by its dest dir.
+   ORIG is where the string lives in .debug_info or .debug_str, STR what
+   it reads as now.  */
+
+static void
+replace_base_dir (DSO *dso, const struct path_rule *r, char *orig, char *str,
+                  unsigned int form, int to_win_path)
+    {
+    size_t base_len = r->base_len;
+    size_t dest_len = r->dest_len;
+
+    if (form == DW_FORM_strp && dso->rebuild_str)
+        {
+        char *s = malloc (dest_len + strlen (str + base_len) + 1);
+
+        if (s == NULL)
+            error (1, errno, "%s: Could not allocate memory", dso->filename);
+        memcpy (s, r->dest, dest_len);
+        strcpy (s + dest_len, str + base_len);
+        if (to_win_path)
+            make_win_path(s);
+        rewrite_str (dso, (unsigned char *) orig
+                          - dso->debug_sections[DEBUG_STR].data, s);
+        return;
+        }
+
+    if (dest_len > base_len)
+        {
+        error (0, 0, "%s: Cannot make DW_FORM_string \"%s\" longer",
+               dso->filename, str);
+        return;
+        }
+
+    memcpy (str, r->dest, dest_len);
+    if (form == DW_FORM_string)
+        {
+        if (dest_len < base_len)
+            memset(str + dest_len, win_path ? '\\' : '/',
+                   base_len - dest_len);
+        dirty_section (dso, DEBUG_INFO);
+        }
+    else
+        {
+        if (dest_len < base_len)
+            memmove (str + dest_len, str + base_len,
+                     strlen (str + base_len) + 1);
+        dirty_section (dso, DEBUG_STR);
+        }
+
+    if (to_win_path)
+        make_win_path(str);
+    }
+
+/* Whether the .debug_str string at ORIG was already looked at for an
+   earlier unit DIE, marking it as looked at either way.  Many units
+   share their comp_dir string, and once rewritten it must not be
+   matched against the rules again.  With --strings-first the marks are
+   what rewrite_debug_str edits.  */
+
+static int
+str_seen_before (DSO *dso, char *orig)
+    {
+    size_t off = (unsigned char *) orig - dso->debug_sections[DEBUG_STR].data;
+    unsigned char bit = 1 << (off & 7);
+
+    if (dso->str_seen == NULL)
+        {
+        dso->str_seen = calloc (dso->debug_sections[DEBUG_STR].size / 8 + 1, 1);
+        if (dso->str_seen == NULL)
+            error (1, errno, "%s: Could not allocate memory", dso->filename);
+        }
+    if (dso->str_seen[off >> 3] & bit)
+        return 1;
+    dso->str_seen[off >> 3] |= bit;
+    return 0;
+    }
+
+/* Whether .debug_str is rewritten by rewrite_debug_str rather than
+   through the unit DIEs.  */
+
+static int
+scan_debug_str (DSO *dso)
+    {
+    return strings_first && rewrite_paths && !win_path && !dso->rebuild_str
+           && dso->debug_sections[DEBUG_STR].data != NULL;
+    }
+
+static void
+apply_patches (DSO *dso, CU *cu)
+    {
+    size_t i;
+    char *comp_dir = NULL;
+
+    for (i = 0; i < cu->npatches; ++i)
+        {
+        char *orig = cu->patches[i].str, *str = orig;
+        unsigned int form = cu->patches[i].form;
+        const struct path_rule *r;
+
+        if (form == DW_FORM_strp && dso->rebuild_str)
+            str = current_str (dso, (unsigned char *) orig
+                                    - dso->debug_sections[DEBUG_STR].data);
+
+        switch (cu->patches[i].kind)
+            {
+            case PATCH_COMP_DIR:
+                comp_dir = cu_strdup (dso, cu, str);
+
+                if (form == DW_FORM_strp
+                        && (str_seen_before (dso, orig) || scan_debug_str (dso)))
+                    break;
+                r = find_rewrite (str);
+                if (r == NULL)
+                    break;
+
+                TRACE (1, "####updating base from %s to %s\n", r->base, r->dest);
+
+                replace_base_dir (dso, r, orig, str, form, 0);
+                break;
+
+            case PATCH_NAME:
+                if (*str == '/' && comp_dir == NULL)
+                    comp_dir = comp_dir_from_name (dso, cu, str);
+
+                if (form == DW_FORM_strp
+                        && (str_seen_before (dso, orig) || scan_debug_str (dso)))
+                    break;
+                r = find_rewrite (str);
+                if (r == NULL)
+                    break;
+
+                TRACE (1, "====updating base from %s to %s\n", r->base, r->dest);
+
+                replace_base_dir (dso, r, orig, str, form, win_path);
+                break;
+
+            case PATCH_END_DIE:
+                if (comp_dir && list_file_fd != -1)
+                    list_comp_dir (&dso->list, comp_dir);
+                comp_dir = NULL;
+                break;
+            }
+        }
+    }
+
+static ALWAYS_INLINE unsigned char *
+edit_attributes (DSO *dso, CU *cu, unsigned char *ptr, struct abbrev_tag *t,
+                 int big_endian, int relocated)
+    {
+    int i;
+    uint32_t list_offs;
+    int found_list_offs;
+    char *comp_dir;
+    size_t queued;
+
+    comp_dir = NULL;
+    list_offs = 0;
+    found_list_offs = 0;
+    queued = cu->npatches;
+    for (i = 0; i < t->nattr; ++i)
+        {
+        uint32_t form = t->attr[i].form;
+
+        while (1)
+            {
+            if (t->attr[i].attr == DW_AT_stmt_list)
                 {
-                char *name;
-                
-                if (form == DW_FORM_strp && debug_sections[DEBUG_STR].data)
+                if (form == DW_FORM_data4
+                        || form == DW_FORM_sec_offset)
                     {
-                    name = (char *) debug_sections[DEBUG_STR].data
-                           + do_read_32_relocated (ptr);
+                    list_offs = buf_read_info_32 (dso, ptr, big_endian,
+                                                  relocated);
+                    found_list_offs = 1;
                     }
-                else if (form == DW_FORM_string && debug_sections[DEBUG_INFO].data)
+                }
+
+            if (t->attr[i].attr == DW_AT_comp_dir)
+                {
+                char *dir = NULL;
+
+                if (form == DW_FORM_string)
+                    dir = (char *) ptr;
+                else if (form == DW_FORM_strp &&
+                         dso->debug_sections[DEBUG_STR].data)
+                    dir = (char *) dso->debug_sections[DEBUG_STR].data
+                          + buf_read_info_32 (dso, ptr, big_endian,
+                                              relocated);
+
+                if (dir != NULL)
                     {
-                    name = (char *)(ptr);
+                    comp_dir = cu_strdup (dso, cu, dir);
+
+                    TRACE (1, "####comp_dir %s\n", comp_dir);
+
+                    if (rewrite_paths || list_file_fd != -1)
+                        queue_patch (dso, cu, PATCH_COMP_DIR, form, dir);
                     }
+                }
+            else if ((t->tag == DW_TAG_compile_unit
+                      || t->tag == DW_TAG_partial_unit)
+                     && t->attr[i].attr == DW_AT_name)
+                {
+                char *name = NULL;
 
-                fprintf(debug_fd, "====name %s\n", name);
-                
-                /* 
-                 * If the compile unit has full path from root '/',
-                 * and the compilation directory is still null,
-                 * then we construct a compilation directory string.
-                 */
-                 
-                if (*name == '/' && comp_dir == NULL)
+                if (form == DW_FORM_strp && dso->debug_sections[DEBUG_STR].data)
+                    name = (char *) dso->debug_sections[DEBUG_STR].data
+                           + buf_read_info_32 (dso, ptr, big_endian,
+                                               relocated);
+                else if (form == DW_FORM_string)
+                    name = (char *) ptr;
+
+                if (name != NULL)
                     {
-                    /* 
-                     * The strrchr() function shall locate the last 
-                     * occurrence of c (converted to a char) in the 
-                     * string pointed to by s. The terminating null 
-                     * byte is considered to be part of the string.
-                     *
-                     * Upon successful completion, strrchr() shall 
-                     * return a pointer to the byte or a null pointer
-                     * if c does not occur in the string.
-                     */
-                     
-                    char *enddir = strrchr (name, '/');
-                    
-                    /* 
-                     * The compilation directory is constructed by 
-                     * removing the file name from the compile unit
-                     * name attribute.
-                     */
-                     
-                    if (enddir != name)
-                        {
-                        comp_dir = malloc (enddir - name + 1);
-                        memcpy (comp_dir, name, enddir - name);
-                        comp_dir [enddir - name] = '\0';
-                        }
-                    else
-                        comp_dir = strdup ("/");
+                    TRACE (1, "====name %s\n", name);
+
+                    if (*name == '/' && comp_dir == NULL)
+                        comp_dir = comp_dir_from_name (dso, cu, name);
+
+                    if (rewrite_paths || list_file_fd != -1)
+                        queue_patch (dso, cu, PATCH_NAME, form, name);
                     }
-                
-                if (phase == 1 && dest_dir && has_prefix (name, base_dir))
-                    {
-                    base_len = strlen (base_dir);
-                    dest_len = strlen (dest_dir);
-                    
-                    fprintf(debug_fd, "====updating base from %s to %s\n", base_dir, dest_dir);
-                    
-                    memcpy (name, dest_dir, dest_len);
-                    
-                    if (form == DW_FORM_strp)
-                        {
-                        if (dest_len < base_len)
-                            {
-                            memmove (name + dest_len, name + base_len,
-                                     strlen (name + base_len) + 1);
-                            }
+                }
 
-                        dirty_section (DEBUG_STR);
-                        }
-                    else 
-                        {
-                        if (dest_len < base_len)
-                            {
-                            if (win_path)
-                                memset(name + dest_len, '\\',
-                                       base_len - dest_len);
-                            else
-                                memset(name + dest_len, '/',
-                                       base_len - dest_len);
-                            }
-                        
-                        dirty_section (DEBUG_INFO);
-                        }
+            if (form == DW_FORM_indirect)
+                {
+                form = read_uleb128 (ptr, cu->end);
+                continue;
+                }
+
+            if (dso->rebuild_str && form == DW_FORM_strp)
+                queue_fixup (dso, cu, ptr,
+                             buf_read_info_32 (dso, ptr, big_endian,
+                                               relocated), DEBUG_STR);
+            else if (dso->rebuild_line
+                     && t->attr[i].attr == DW_AT_stmt_list
+                     && (form == DW_FORM_data4
+                         || form == DW_FORM_sec_offset))
+                queue_fixup (dso, cu, ptr,
+                             buf_read_info_32 (dso, ptr, big_endian,
+                                               relocated), DEBUG_LINE);
+
+            ptr = skip_form (dso, cu, ptr, form, big_endian);
+            if (ptr == NULL)
+                return NULL;
+
+            break;
+            }
+        }
+
+    /* Ensure the CU current directory will exist even if only empty.  Source
+       filenames possibly located in its parent directories refer relatively to
+       it and the debugger (GDB) cannot safely optimize out the missing
+       CU current dir subdirectories.  The list file entry and the line table
+       edit are done later by run_line_job.  */
+    if (comp_dir)
+        {
+        LINE_JOB *job = new_line_job (dso, cu);
+
+        job->comp_dir = comp_dir;
+        job->list_offs = list_offs;
+        job->has_line = found_list_offs;
+        }
+
+    if (cu->npatches != queued)
+        queue_patch (dso, cu, PATCH_END_DIE, 0, NULL);
+
+    return ptr;
+    }
+
+/* Whether a rule would have to make a DW_FORM_string unit name or
+   comp_dir of CU longer.  Those live in .debug_info and cannot grow.  */
+
+static int
+unit_strings_grow (DSO *dso, CU *cu)
+    {
+    size_t i;
+
+    for (i = 0; i < cu->npatches; ++i)
+        if (cu->patches[i].form == DW_FORM_string)
+            {
+            const struct path_rule *r = find_rewrite (cu->patches[i].str);
+
+            if (r != NULL && r->dest_len > r->base_len)
+                {
+                error (0, 0, "%s: Cannot make DW_FORM_string \"%s\" longer",
+                       dso->filename, cu->patches[i].str);
+                return 1;
+                }
+            }
+    return 0;
+    }
+
+static void
+run_line_job (DSO *dso, LINE_JOB *job)
+    {
+    if (job->repeat == LINE_REPEAT)
+        return;
+
+    if (list_file_fd != -1)
+        list_comp_dir (&job->list, job->comp_dir);
+
+    if (job->has_line)
+        edit_dwarf2_line (dso, job);
+    }
+
+/*
+ * Everything edit_attributes acts on lives in the unit DIE, so once that
+ * is handled the rest of the CU can be skipped, unless some enabled
+ * feature needs to see the child DIEs as well.  Rebuilding .debug_str
+ * does: every DW_FORM_strp in the CU has to be remapped.
+ */
+
+static int
+need_child_dies (DSO *dso)
+    {
+    return all_dies || dso->rebuild_str;
+    }
+
+/* Decode the DIEs of CU, queueing its line jobs and patches.  */
+
+static ALWAYS_INLINE void
+walk_cu (DSO *dso, CU *cu, int big_endian, int relocated)
+    {
+    unsigned char *ptr = cu->ptr;
+    struct abbrev_tag *t;
+    uint64_t entry;
+    int root_only = !need_child_dies (dso);
+
+    while (ptr < cu->end)
+        {
+        entry = read_uleb128 (ptr, cu->end);
+        if (entry == 0)
+            continue;
+        /* read_abbrev takes no code above UINT_MAX, so a larger one,
+           or one cut off by the end of the unit, cannot be looked up.  */
+        if (entry > UINT_MAX)
+            {
+            error (0, 0, "%s: Invalid or truncated DWARF abbreviation code",
+                   dso->filename);
+            cu->failed = 1;
+            return;
+            }
+        t = find_abbrev (cu->abbrev, entry);
+        if (t == NULL)
+            {
+            error (0, 0, "%s: Could not find DWARF abbreviation %u",
+                   dso->filename, (unsigned int) entry);
+            cu->failed = 1;
+            return;
+            }
+
+        if (t->interesting)
+            ptr = edit_attributes (dso, cu, ptr, t, big_endian, relocated);
+        else
+            ptr = skip_attributes (dso, cu, ptr, t, big_endian);
+        if (ptr == NULL)
+            break;
+
+        if (root_only && (t->tag == DW_TAG_compile_unit
+                          || t->tag == DW_TAG_partial_unit))
+            ptr = cu->end;
+        }
+    }
+
+/*
+ * With -j the CUs are walked, and their line tables edited, on a pool of
+ * threads.  CUs only share .debug_line tables and .debug_str strings:
+ * a line table is claimed by the first job (in CU order) referring to
+ * it, and any later jobs for the same table under another comp_dir are
+ * run afterwards, in order, on the calling thread; the string rewrites
+ * are always replayed serially by apply_patches.  The result is the
+ * same for any -j.
+ */
+
+struct walk_data
+    {
+    DSO *dso;
+    CU *cus;
+    void (*walk_cu) (DSO *, CU *);
+    LINE_JOB **jobs;
+    };
+
+struct line_table
+    {
+    uint32_t offset;
+    const char *comp_dir;
+    };
+
+/* The instances of walk_cu, of which one is picked for each DSO.  The
+   relocated copy of .debug_info only exists in ET_REL files.  */
+
+static void
+walk_cu_le (DSO *dso, CU *cu)
+    {
+    walk_cu (dso, cu, 0, 0);
+    }
+
+static void
+walk_cu_be (DSO *dso, CU *cu)
+    {
+    walk_cu (dso, cu, 1, 0);
+    }
+
+static void
+walk_cu_le_relocated (DSO *dso, CU *cu)
+    {
+    walk_cu (dso, cu, 0, 1);
+    }
+
+static void
+walk_cu_be_relocated (DSO *dso, CU *cu)
+    {
+    walk_cu (dso, cu, 1, 1);
+    }
+
+static void
+walk_cu_item (size_t i, void *data)
+    {
+    struct walk_data *wd = (struct walk_data *)data;
+
+    wd->walk_cu (wd->dso, &wd->cus[i]);
+    }
+
+static void
+line_job_item (size_t i, void *data)
+    {
+    struct walk_data *wd = (struct walk_data *)data;
+
+    run_line_job (wd->dso, wd->jobs[i]);
+    }
+
+static hashval_t
+line_table_hash (const void *p)
+    {
+    return ((const struct line_table *) p)->offset;
+    }
+
+static int
+line_table_eq (const void *p, const void *q)
+    {
+    return ((const struct line_table *) p)->offset
+           == ((const struct line_table *) q)->offset;
+    }
+
+/* Record that JOB handles its line table, or mark it as a repeat of the
+   job that already did.  */
+
+static void
+claim_line_table (DSO *dso, LINE_JOB *job)
+    {
+    struct line_table *lt, key;
+    void **slot;
+
+    if (dso->line_tables == NULL)
+        {
+        dso->line_tables = htab_try_create (50, line_table_hash,
+                                            line_table_eq, free);
+        if (dso->line_tables == NULL)
+            error (1, ENOMEM, "%s: Could not allocate memory", dso->filename);
+        }
+
+    key.offset = job->list_offs;
+    slot = htab_find_slot_with_hash (dso->line_tables, &key, key.offset,
+                                     INSERT);
+    if (slot == NULL)
+        error (1, ENOMEM, "%s: Could not allocate memory", dso->filename);
+    if (*slot == NULL)
+        {
+        lt = malloc (sizeof (*lt));
+        if (lt == NULL)
+            error (1, errno, "%s: Could not allocate memory", dso->filename);
+        lt->offset = job->list_offs;
+        lt->comp_dir = job->comp_dir;
+        *slot = lt;
+        job->repeat = LINE_FIRST;
+        return;
+        }
+
+    lt = (struct line_table *) *slot;
+    if (strcmp (lt->comp_dir, job->comp_dir) == 0)
+        {
+        job->repeat = LINE_REPEAT;
+        dso->stats.line_repeats++;
+        }
+    else
+        {
+        error (0, 0, "%s: .debug_line table at offset 0x%x is shared by units with comp_dir %s and %s",
+               dso->filename, job->list_offs, lt->comp_dir, job->comp_dir);
+        job->repeat = LINE_CONFLICT;
+        }
+    }
+
+/*
+ * With --strings-first the .debug_str strings are not rewritten as the
+ * unit DIEs referring to them are applied, but afterwards, by scanning
+ * the section in chunks on several threads for the offsets the unit
+ * DIEs referred to, which str_seen_before marked.  Those are the
+ * strings the DIE-driven edit would rewrite, including the ones a
+ * linker merged into the tail of a longer string; the other strings
+ * under a base dir are left alone just the same.  Each chunk ends at
+ * the end of a string, and an edit never goes past the end of its
+ * string, so the chunks never touch.  Where two referred to offsets
+ * fall in one string, the later one is edited first.
+ *
+ * The same strings are only given the same edit when nothing but the
+ * base dir is replaced in them: -w converts names but not directories,
+ * and a rebuilt table is remapped string by string anyway, so those
+ * fall back to the DIE-driven edit.
+ */
+
+#define STR_SCAN_CHUNK (256 * 1024)
+
+struct str_scan
+    {
+    DSO *dso;
+    /* Where the strings of each chunk start, and where those of the
+       next one do.  */
+    size_t *starts;
+    unsigned long *edits;
+    };
+
+static void
+str_scan_item (size_t i, void *data)
+    {
+    struct str_scan *ss = (struct str_scan *) data;
+    struct debug_section *sec = &ss->dso->debug_sections[DEBUG_STR];
+    const unsigned char *seen = ss->dso->str_seen;
+    char *limit = (char *) sec->data + sec->size;
+    const struct path_rule *r;
+    size_t off, len;
+    char *p;
+
+    for (off = ss->starts[i + 1]; off-- > ss->starts[i]; )
+        {
+        if (seen[off >> 3] == 0)
+            {
+            off &= ~(size_t) 7;
+            continue;
+            }
+        if ((seen[off >> 3] & (1 << (off & 7))) == 0)
+            continue;
+        p = (char *) sec->data + off;
+        len = strnlen (p, limit - p);
+        if (p + len == limit)
+            continue;
+        r = find_rewrite (p);
+        if (r == NULL || r->dest_len > r->base_len)
+            continue;
+
+        TRACE (1, "####updating string base from %s to %s\n",
+               r->base, r->dest);
+
+        memcpy (p, r->dest, r->dest_len);
+        if (r->dest_len < r->base_len)
+            memmove (p + r->dest_len, p + r->base_len,
+                     len - r->base_len + 1);
+        ss->edits[i]++;
+        }
+    }
+
+static void
+rewrite_debug_str (DSO *dso)
+    {
+    struct debug_section *sec = &dso->debug_sections[DEBUG_STR];
+    struct str_scan ss;
+    size_t i, n = sec->size / STR_SCAN_CHUNK + 1;
+    unsigned long edits = 0;
+    unsigned char *p;
+
+    /* No unit DIE referred to .debug_str.  */
+    if (dso->str_seen == NULL)
+        return;
+
+    ss.dso = dso;
+    ss.starts = malloc ((n + 1) * sizeof (size_t));
+    ss.edits = calloc (n, sizeof (unsigned long));
+    if (ss.starts == NULL || ss.edits == NULL)
+        error (1, errno, "%s: Could not allocate memory", dso->filename);
+
+    /* A chunk boundary inside a string moves to its end, before any
+       string is edited.  */
+    ss.starts[0] = 0;
+    for (i = 1; i < n; ++i)
+        {
+        ss.starts[i] = i * STR_SCAN_CHUNK;
+        if (ss.starts[i] < ss.starts[i - 1])
+            ss.starts[i] = ss.starts[i - 1];
+        else if (sec->data[ss.starts[i] - 1] != '\0')
+            {
+            p = memchr (sec->data + ss.starts[i], '\0',
+                        sec->size - ss.starts[i]);
+            ss.starts[i] = p ? p + 1 - sec->data : sec->size;
+            }
+        }
+    ss.starts[n] = sec->size;
+
+    workq_run (n, cu_jobs, str_scan_item, &ss);
+    for (i = 0; i < n; ++i)
+        edits += ss.edits[i];
+    free (ss.starts);
+    free (ss.edits);
+
+    if (edits)
+        dirty_section (dso, DEBUG_STR);
+    }
+
+/* Walk NCUS CUs, edit their line tables and rewrite their unit strings.
+   If some CU cannot be walked, or HEADER_FAILED says the CU after the
+   last one could not even be parsed, only the line tables of the CUs up
+   to there are edited, as a serial walk stopping at that point would
+   have done, and nothing is rewritten.  */
+
+static int
+process_cus (DSO *dso, CU *cus, size_t ncus, int header_failed)
+    {
+    struct walk_data wd;
+    LINE_JOB **jobs;
+    size_t i, j, njobs, nfirst;
+    int ret = header_failed;
+
+    wd.dso = dso;
+    wd.cus = cus;
+    if (dso->ehdr.e_ident[EI_DATA] == ELFDATA2MSB)
+        wd.walk_cu = dso->info_relocated ? walk_cu_be_relocated : walk_cu_be;
+    else
+        wd.walk_cu = dso->info_relocated ? walk_cu_le_relocated : walk_cu_le;
+    wd.jobs = NULL;
+    workq_run (ncus, cu_jobs, walk_cu_item, &wd);
+
+    for (i = 0; i < ncus; ++i)
+        if (cus[i].failed)
+            {
+            ncus = i + 1;
+            ret = 1;
+            break;
+            }
+
+    /* Fail before anything is edited if the unit strings cannot all
+       be rewritten.  */
+    for (i = 0; grow_paths && i < ncus; ++i)
+        if (unit_strings_grow (dso, &cus[i]))
+            return 1;
+
+    for (i = 0, njobs = 0; i < ncus; ++i)
+        njobs += cus[i].njobs;
+
+    jobs = malloc ((njobs + 1) * sizeof (LINE_JOB *));
+    if (jobs == NULL)
+        error (1, errno, "%s: Could not allocate memory", dso->filename);
+
+    for (i = 0, njobs = 0; i < ncus; ++i)
+        for (j = 0; j < cus[i].njobs; ++j, ++njobs)
+            {
+            jobs[njobs] = &cus[i].jobs[j];
+            if (jobs[njobs]->has_line)
+                claim_line_table (dso, jobs[njobs]);
+            }
+
+    /* Run the first jobs for each table in parallel, then the
+       conflicting repeats in order.  */
+    wd.jobs = malloc ((njobs + 1) * sizeof (LINE_JOB *));
+    if (wd.jobs == NULL)
+        error (1, errno, "%s: Could not allocate memory", dso->filename);
+    for (i = 0, nfirst = 0; i < njobs; ++i)
+        if (jobs[i]->repeat == LINE_FIRST)
+            wd.jobs[nfirst++] = jobs[i];
+    if (list_file_fd != -1)
+        {
+        dso->path_cache = chtab_create (1024, path_cache_hash,
+                                        path_cache_eq, free);
+        if (dso->path_cache == NULL)
+            error (1, ENOMEM, "%s: Could not allocate memory", dso->filename);
+        }
+    workq_run (nfirst, cu_jobs, line_job_item, &wd);
+    for (i = 0; i < njobs; ++i)
+        if (jobs[i]->repeat == LINE_CONFLICT)
+            run_line_job (dso, jobs[i]);
+    free (wd.jobs);
+    if (dso->path_cache != NULL)
+        {
+        chtab_delete (dso->path_cache);
+        dso->path_cache = NULL;
+        }
+
+    for (i = 0; i < njobs; ++i)
+        {
+        unsigned int sec;
+
+        if (jobs[i]->list.len)
+            list_append (&dso->list, jobs[i]->list.buf, jobs[i]->list.len);
+        dso->stats.arena_allocs += jobs[i]->arena_allocs;
+        dso->stats.arena_blocks += jobs[i]->arena_blocks;
+        dso->stats.path_hits += jobs[i]->path_hits;
+        dso->stats.path_misses += jobs[i]->path_misses;
+        for (sec = 0; jobs[i]->dirty; ++sec)
+            if (jobs[i]->dirty & (1 << sec))
+                {
+                dirty_section (dso, sec);
+                jobs[i]->dirty &= ~(1 << sec);
+                }
+        }
+    free (jobs);
+
+    /* All line tables are done; now rewrite the unit names and
+       compilation directories collected during the walk.  */
+    if (ret == 0)
+        for (i = 0; i < ncus; ++i)
+            apply_patches (dso, &cus[i]);
+    if (ret == 0 && scan_debug_str (dso))
+        rewrite_debug_str (dso);
+
+    return ret;
+    }
+
+static void
+free_cus (DSO *dso, CU *cus, size_t ncus)
+    {
+    size_t i, j;
+
+    for (i = 0; i < ncus; ++i)
+        {
+        dso->stats.arena_allocs += cus[i].arena.nallocs;
+        dso->stats.arena_blocks += cus[i].arena.nblocks;
+        arena_release (&cus[i].arena);
+        for (j = 0; j < cus[i].njobs; ++j)
+            {
+            free (cus[i].jobs[j].list.buf);
+            free (cus[i].jobs[j].line);
+            }
+        free (cus[i].jobs);
+        free (cus[i].patches);
+        free (cus[i].fixups);
+        }
+    free (cus);
+    }
+
+/*
+ * Rebuilding .debug_str or .debug_line changes their size, which moves
+ * everything after them in the file.  That is only possible as long as
+ * nothing that is loaded comes after SEC.
+ */
+
+static int
+can_resize_section (DSO *dso, int sec)
+    {
+    GElf_Off offset = dso->shdr[sec].sh_offset;
+    int i;
+
+    if (sec == 0)
+        return 1;
+    if (dso->ehdr.e_phnum && dso->ehdr.e_phoff > offset)
+        return 0;
+    for (i = 1; i < dso->ehdr.e_shnum; ++i)
+        if ((dso->shdr[i].sh_flags & SHF_ALLOC)
+                && dso->shdr[i].sh_type != SHT_NOBITS
+                && dso->shdr[i].sh_offset > offset)
+            return 0;
+    return 1;
+    }
+
+/* Make BUF of SIZE bytes the new contents of debug section SEC.  */
+
+static void
+replace_section (DSO *dso, int sec, unsigned char *buf, size_t size)
+    {
+    struct debug_section *ds = &dso->debug_sections[sec];
+
+    if (ds->rebuilt)
+        free (ds->data);
+    ds->data = buf;
+    ds->size = size;
+    ds->rebuilt = 1;
+    ds->elf_data->d_buf = buf;
+    ds->elf_data->d_size = size;
+    dirty_section (dso, sec);
+    }
+
+struct layout
+    {
+    GElf_Off offset;
+    GElf_Xword size, new_size, align;
+    int sec;
+    };
+
+static int
+layout_cmp (const void *a, const void *b)
+    {
+    const struct layout *la = (const struct layout *) a;
+    const struct layout *lb = (const struct layout *) b;
+
+    if (la->offset != lb->offset)
+        return la->offset < lb->offset ? -1 : 1;
+    return la->sec - lb->sec;
+    }
+
+/* Give the rebuilt sections their new sizes, and move every section
+   after them, and the section header table, along to make room.  Gaps
+   and alignment between sections are kept.  */
+
+static void
+relayout_sections (DSO *dso)
+    {
+    struct layout *l;
+    int i, j, n = 0;
+    int64_t shift = 0;
+
+    l = malloc ((dso->ehdr.e_shnum + 1) * sizeof (struct layout));
+    if (l == NULL)
+        error (1, errno, "%s: Could not allocate memory", dso->filename);
+
+    for (i = 1; i < dso->ehdr.e_shnum; ++i)
+        {
+        l[n].offset = dso->shdr[i].sh_offset;
+        l[n].size = l[n].new_size
+                  = dso->shdr[i].sh_type == SHT_NOBITS ? 0 : dso->shdr[i].sh_size;
+        l[n].align = dso->shdr[i].sh_addralign;
+        l[n].sec = i;
+        for (j = 0; dso->debug_sections[j].name; ++j)
+            if (dso->debug_sections[j].sec == i && dso->debug_sections[j].rebuilt)
+                l[n].new_size = dso->debug_sections[j].size;
+        ++n;
+        }
+    l[n].offset = dso->ehdr.e_shoff;
+    l[n].size = l[n].new_size = dso->ehdr.e_shnum * dso->ehdr.e_shentsize;
+    l[n].align = gelf_getclass (dso->elf) == ELFCLASS64 ? 8 : 4;
+    l[n].sec = 0;
+    ++n;
+
+    qsort (l, n, sizeof (struct layout), layout_cmp);
+
+    for (j = 0; j < n; ++j)
+        {
+        GElf_Off offset = l[j].offset + shift;
+
+        if (l[j].align > 1)
+            offset = (offset + l[j].align - 1) & ~(l[j].align - 1);
+        shift = (int64_t) (offset + l[j].new_size) - (l[j].offset + l[j].size);
+
+        i = l[j].sec;
+        if (i == 0)
+            dso->ehdr.e_shoff = offset;
+        else if (offset != l[j].offset || l[j].new_size != l[j].size)
+            {
+            /* Read in a moved section before its header says it lives
+               somewhere else, and have it written out again there.  */
+            if (l[j].new_size == l[j].size
+                    && dso->shdr[i].sh_type != SHT_NOBITS)
+                {
+                Elf_Data *data = elf_getdata (dso->scn[i], NULL);
+
+                if (data != NULL)
+                    elf_flagdata (data, ELF_C_SET, ELF_F_DIRTY);
+                }
+            dso->shdr[i].sh_offset = offset;
+            if (dso->shdr[i].sh_type != SHT_NOBITS)
+                dso->shdr[i].sh_size = l[j].new_size;
+            gelf_update_shdr (dso->scn[i], &dso->shdr[i]);
+            }
+        }
+
+    gelf_update_ehdr (dso->elf, &dso->ehdr);
+    dso->dirty_elf = 1;
+    free (l);
+    }
+
+struct line_move
+    {
+    uint32_t old_offset, new_offset;
+    };
+
+static int
+line_job_cmp (const void *a, const void *b)
+    {
+    uint32_t oa = (*(LINE_JOB *const *) a)->list_offs;
+    uint32_t ob = (*(LINE_JOB *const *) b)->list_offs;
+
+    return oa < ob ? -1 : oa > ob;
+    }
+
+static int
+line_move_cmp (const void *a, const void *b)
+    {
+    uint32_t oa = ((const struct line_move *) a)->old_offset;
+    uint32_t ob = ((const struct line_move *) b)->old_offset;
+
+    return oa < ob ? -1 : oa > ob;
+    }
+
+/* Put the line tables rewritten by rebuild_line_table in place of the
+   old ones, and point every DW_AT_stmt_list at where its table ends up.  */
+
+static int
+rebuild_debug_line (DSO *dso, CU *cus, size_t ncus)
+    {
+    struct debug_section *sec = &dso->debug_sections[DEBUG_LINE];
+    LINE_JOB **jobs;
+    struct line_move *moves = NULL, key, *move;
+    size_t njobs = 0, nmoves = 0, max_moves = 0, i, j, k;
+    unsigned char *ptr, *end;
+    LIST out;
+    int ret = 0;
+
+    for (i = 0; i < ncus; ++i)
+        for (j = 0; j < cus[i].njobs; ++j)
+            if (cus[i].jobs[j].line != NULL
+                    && cus[i].jobs[j].repeat == LINE_FIRST)
+                ++njobs;
+    if (njobs == 0)
+        return 0;
+
+    jobs = malloc (njobs * sizeof (LINE_JOB *));
+    if (jobs == NULL)
+        error (1, errno, "%s: Could not allocate memory", dso->filename);
+    for (i = 0, k = 0; i < ncus; ++i)
+        for (j = 0; j < cus[i].njobs; ++j)
+            if (cus[i].jobs[j].line != NULL
+                    && cus[i].jobs[j].repeat == LINE_FIRST)
+                jobs[k++] = &cus[i].jobs[j];
+    qsort (jobs, njobs, sizeof (LINE_JOB *), line_job_cmp);
+
+    memset (&out, 0, sizeof (out));
+    ptr = sec->data;
+    end = ptr + sec->size;
+    k = 0;
+    while (ptr < end)
+        {
+        unsigned char *unit_end = end;
+        uint32_t len;
+
+        if (end - ptr >= 4)
+            {
+            len = dso->do_read_32 (ptr);
+            if (len < 0xfffffff0 && len <= (size_t) (end - ptr - 4))
+                unit_end = ptr + 4 + len;
+            }
+
+        if (nmoves == max_moves)
+            {
+            max_moves = max_moves ? 2 * max_moves : 64;
+            moves = realloc (moves, max_moves * sizeof (struct line_move));
+            if (moves == NULL)
+                error (1, errno, "%s: Could not allocate memory",
+                       dso->filename);
+            }
+        moves[nmoves].old_offset = ptr - sec->data;
+        moves[nmoves].new_offset = out.len;
+        nmoves++;
+
+        if (k < njobs && jobs[k]->list_offs == (uint32_t) (ptr - sec->data))
+            {
+            list_append (&out, (char *) jobs[k]->line, jobs[k]->line_len);
+            ++k;
+            }
+        else
+            list_append (&out, (char *) ptr, unit_end - ptr);
+        ptr = unit_end;
+        }
+
+    if (k < njobs)
+        {
+        error (0, 0, "%s: .debug_line table at offset %u not found",
+               dso->filename, jobs[k]->list_offs);
+        ret = 1;
+        goto out;
+        }
 
-                    if (win_path)
-                        make_win_path((char *)name);
-                   
+    /* Check every reference can be moved before moving any.  */
+    for (i = 0; i < ncus; ++i)
+        for (j = 0; j < cus[i].nfixups; ++j)
+            if (cus[i].fixups[j].sec == DEBUG_LINE)
+                {
+                key.old_offset = cus[i].fixups[j].offset;
+                if (bsearch (&key, moves, nmoves, sizeof (struct line_move),
+                             line_move_cmp) == NULL)
+                    {
+                    error (0, 0, "%s: DW_AT_stmt_list offset %u is not a line table",
+                           dso->filename, key.old_offset);
+                    ret = 1;
+                    goto out;
                     }
-                    
                 }
 
-            switch (form)
+    for (i = 0; i < ncus; ++i)
+        for (j = 0; j < cus[i].nfixups; ++j)
+            if (cus[i].fixups[j].sec == DEBUG_LINE)
                 {
-                case DW_FORM_ref_addr:
-                    if (cu_version == 2)
-                        ptr += ptr_size;
-                    else
-                        ptr += 4;
-                    break;
-                case DW_FORM_flag_present:
-                    break;
-                case DW_FORM_addr:
-                    ptr += ptr_size;
-                    break;
-                case DW_FORM_ref1:
-                case DW_FORM_flag:
-                case DW_FORM_data1:
-                    ++ptr;
-                    break;
-                case DW_FORM_ref2:
-                case DW_FORM_data2:
-                    ptr += 2;
-                    break;
-                case DW_FORM_ref4:
-                case DW_FORM_data4:
-                case DW_FORM_sec_offset:
-                    ptr += 4;
-                    break;
-                case DW_FORM_ref8:
-                case DW_FORM_data8:
-                case DW_FORM_ref_sig8:
-                    ptr += 8;
-                    break;
-                case DW_FORM_sdata:
-                case DW_FORM_ref_udata:
-                case DW_FORM_udata:
-                    read_uleb128 (ptr);
-                    break;
-                case DW_FORM_strp:
-                    ptr += 4;
-                    break;
-                case DW_FORM_string:
-                    ptr = (unsigned char *) strchr ((char *)ptr, '\0') + 1;
-                    break;
-                case DW_FORM_indirect:
-                    form = read_uleb128 (ptr);
-                    continue;
-                case DW_FORM_block1:
-                    len = *ptr++;
-                    break;
-                case DW_FORM_block2:
-                    len = read_16 (ptr);
-                    form = DW_FORM_block1;
-                    break;
-                case DW_FORM_block4:
-                    len = read_32 (ptr);
-                    form = DW_FORM_block1;
-                    break;
-                case DW_FORM_block:
-                case DW_FORM_exprloc:
-                    len = read_uleb128 (ptr);
-                    form = DW_FORM_block1;
-                    assert (len < UINT_MAX);
-                    break;
-                default:
-                    error (0, 0, "%s: Unknown DWARF DW_FORM_%d", dso->filename,
-                           form);
-                    return NULL;
+                key.old_offset = cus[i].fixups[j].offset;
+                move = bsearch (&key, moves, nmoves, sizeof (struct line_move),
+                                line_move_cmp);
+                dso->write_32 (cus[i].fixups[j].ptr, move->new_offset);
                 }
+    dirty_section (dso, DEBUG_INFO);
 
-            if (form == DW_FORM_block1)
-                ptr += len;
+    replace_section (dso, DEBUG_LINE, (unsigned char *) out.buf, out.len);
+    out.buf = NULL;
 
-            break;
-            }
-        }
+out:
+    free (out.buf);
+    free (moves);
+    free (jobs);
+    return ret;
+    }
 
-    /* Ensure the CU current directory will exist even if only empty.  Source
-       filenames possibly located in its parent directories refer relatively to
-       it and the debugger (GDB) cannot safely optimize out the missing
-       CU current dir subdirectories.  */
-    if (comp_dir && list_file_fd != -1)
-        {
-        char *p;
+/* A distinct string referenced from .debug_info, and where it moves to
+   in the rebuilt .debug_str.  */
 
-        if (base_dir && has_prefix (comp_dir, base_dir))
-            p = comp_dir + strlen (base_dir);
-        else if (dest_dir && has_prefix (comp_dir, dest_dir))
-            p = comp_dir + strlen (dest_dir);
-        else
-            p = comp_dir;
+struct str_entry
+    {
+    uint32_t offset, new_offset;
+    const char *str;
+    size_t len;
+    };
 
-        append_list_file(p, LST_DIR);
-        }
+static int
+str_entry_cmp (const void *a, const void *b)
+    {
+    uint32_t oa = ((const struct str_entry *) a)->offset;
+    uint32_t ob = ((const struct str_entry *) b)->offset;
 
-    if (found_list_offs && comp_dir)
-        edit_dwarf2_line (dso, list_offs, comp_dir, phase);
+    return oa < ob ? -1 : oa > ob;
+    }
 
-    free (comp_dir);
+/* Order strings by their reversed contents, so that a string is
+   followed by those it is a suffix of.  */
 
-    return ptr;
+static int
+str_entry_rev_cmp (const void *a, const void *b)
+    {
+    const struct str_entry *ea = *(const struct str_entry *const *) a;
+    const struct str_entry *eb = *(const struct str_entry *const *) b;
+    size_t i = ea->len, j = eb->len;
+
+    while (i > 0 && j > 0)
+        {
+        unsigned char ca = ea->str[--i], cb = eb->str[--j];
+
+        if (ca != cb)
+            return ca < cb ? -1 : 1;
+        }
+    return i > 0 ? 1 : j > 0 ? -1 : 0;
     }
 
+/*
+ * Lay out a new .debug_str holding just the strings .debug_info refers
+ * to, with the unit strings rewritten, identical strings stored once and
+ * strings that end another one stored as its tail.  Then point every
+ * DW_FORM_strp at its string's new place.
+ */
+
 static int
-rel_cmp (const void *a, const void *b)
+rebuild_debug_str (DSO *dso, CU *cus, size_t ncus)
     {
-    REL *rela = (REL *) a, *relb = (REL *) b;
+    struct debug_section *sec = &dso->debug_sections[DEBUG_STR];
+    struct str_entry *entries, **sorted, *e, key;
+    size_t n = 0, m, i, j, size, pos;
+    unsigned char *buf;
 
-    if (rela->ptr < relb->ptr)
-        return -1;
+    if (sec->data == NULL)
+        return 0;
+    /* Without -r, a file with nothing to rewrite is left alone.  */
+    if (!rebuild_strings
+            && (dso->str_rewrites == NULL
+                || htab_elements (dso->str_rewrites) == 0))
+        return 0;
 
-    if (rela->ptr > relb->ptr)
-        return 1;
+    for (i = 0; i < ncus; ++i)
+        for (j = 0; j < cus[i].nfixups; ++j)
+            if (cus[i].fixups[j].sec == DEBUG_STR)
+                ++n;
+
+    entries = malloc ((n + 1) * sizeof (struct str_entry));
+    sorted = malloc ((n + 1) * sizeof (struct str_entry *));
+    if (entries == NULL || sorted == NULL)
+        error (1, errno, "%s: Could not allocate memory", dso->filename);
+
+    for (i = 0, n = 0; i < ncus; ++i)
+        for (j = 0; j < cus[i].nfixups; ++j)
+            if (cus[i].fixups[j].sec == DEBUG_STR)
+                {
+                if (cus[i].fixups[j].offset >= sec->size)
+                    {
+                    error (0, 0, "%s: DW_FORM_strp offset %u out of range",
+                           dso->filename, cus[i].fixups[j].offset);
+                    free (entries);
+                    free (sorted);
+                    return 1;
+                    }
+                entries[n++].offset = cus[i].fixups[j].offset;
+                }
+
+    qsort (entries, n, sizeof (struct str_entry), str_entry_cmp);
+    for (i = 0, m = 0, size = 0; i < n; ++i)
+        {
+        if (m > 0 && entries[m - 1].offset == entries[i].offset)
+            continue;
+        e = &entries[m];
+        e->offset = entries[i].offset;
+        e->str = current_str (dso, e->offset);
+        if (e->str == (char *) sec->data + e->offset)
+            {
+            e->len = strnlen (e->str, sec->size - e->offset);
+            if (e->len == sec->size - e->offset)
+                {
+                error (0, 0, "%s: .debug_str string at %u is not terminated",
+                       dso->filename, e->offset);
+                free (entries);
+                free (sorted);
+                return 1;
+                }
+            }
+        else
+            e->len = strlen (e->str);
+        size += e->len + 1;
+        sorted[m++] = e;
+        }
+
+    qsort (sorted, m, sizeof (struct str_entry *), str_entry_rev_cmp);
+
+    buf = malloc (size + 1);
+    if (buf == NULL)
+        error (1, errno, "%s: Could not allocate memory", dso->filename);
+    for (i = m, pos = 0; i-- > 0; )
+        {
+        e = sorted[i];
+        if (i + 1 < m)
+            {
+            struct str_entry *next = sorted[i + 1];
+
+            if (next->len >= e->len
+                    && memcmp (next->str + next->len - e->len, e->str, e->len) == 0)
+                {
+                e->new_offset = next->new_offset + next->len - e->len;
+                continue;
+                }
+            }
+        e->new_offset = pos;
+        memcpy (buf + pos, e->str, e->len + 1);
+        pos += e->len + 1;
+        }
+
+    for (i = 0; i < ncus; ++i)
+        for (j = 0; j < cus[i].nfixups; ++j)
+            if (cus[i].fixups[j].sec == DEBUG_STR)
+                {
+                key.offset = cus[i].fixups[j].offset;
+                e = bsearch (&key, entries, m, sizeof (struct str_entry),
+                             str_entry_cmp);
+                dso->write_32 (cus[i].fixups[j].ptr, e->new_offset);
+                }
+    dirty_section (dso, DEBUG_INFO);
 
+    replace_section (dso, DEBUG_STR, buf, pos);
+    free (sorted);
+    free (entries);
     return 0;
     }
 
-static void
+/* Rewrite the FILE symbols under a base dir.  .strtab is edited in
+   place, so if one of them would have to grow, nothing is edited and
+   1 is returned.  */
+
+static int
 edit_symtab (DSO *dso, Elf_Data *data)
     {
     GElf_Sym sym;
@@ -1151,13 +3175,33 @@ edit_symtab (DSO *dso, Elf_Data *data)
     unsigned long stridx = -1;
     int i;
     char *s;
-    int sec = debug_sections[DEBUG_SYMTAB].sec;
+    int sec = dso->debug_sections[DEBUG_SYMTAB].sec;
     Elf_Data *strtab_data;
     gelf_getshdr(dso->scn[sec], &shdr);
 
     stridx = shdr.sh_link;
 
     strtab_data = elf_getdata(dso->scn[stridx], NULL);
+    if (!data_in_map (dso, strtab_data))
+        {
+        error (0, 0, "%s: Cannot edit .strtab in place", dso->filename);
+        return 0;
+        }
+
+    for (i = 0; grow_paths && gelf_getsym (data, i, &sym) != NULL; i++)
+        if (GELF_ST_TYPE (sym.st_info) == STT_FILE)
+            {
+            const struct path_rule *r;
+
+            s = elf_strptr (dso->elf, stridx, sym.st_name);
+            r = s != NULL ? find_rewrite (s) : NULL;
+            if (r != NULL && r->dest_len > r->base_len)
+                {
+                error (0, 0, "%s: Cannot make FILE symbol \"%s\" longer",
+                       dso->filename, s);
+                return 1;
+                }
+            }
     
     i = 0;
     while (gelf_getsym(data, i++, &sym) != NULL) 
@@ -1166,16 +3210,18 @@ edit_symtab (DSO *dso, Elf_Data *data)
 
         if (GELF_ST_TYPE(sym.st_info) == STT_FILE)
             {
-            fprintf(debug_fd, "file %s\n", s);
+            TRACE (2, "file %s\n", s);
             
-            if (dest_dir && has_prefix (s, base_dir))
+            const struct path_rule *r = find_rewrite (s);
+
+            if (r != NULL)
                 {
-                int base_len = strlen (base_dir);
-                int dest_len = strlen (dest_dir);
-            
-                fprintf(debug_fd, "!!!!updating symbol file base from %s to %s\n", base_dir, dest_dir);
+                size_t base_len = r->base_len;
+                size_t dest_len = r->dest_len;
+
+                TRACE (1, "!!!!updating symbol file base from %s to %s\n", r->base, r->dest);
             
-                memcpy (s, dest_dir, dest_len);
+                memcpy (s, r->dest, dest_len);
                 if (dest_len < base_len)
                     {
                     memmove (s + dest_len, s + base_len,
@@ -1185,13 +3231,131 @@ edit_symtab (DSO *dso, Elf_Data *data)
                 make_win_path(s);
                 
                 elf_flagdata (strtab_data, ELF_C_SET, ELF_F_DIRTY);
+                dso->dirty_elf = 1;
                 }
             }
         else
             {
-            fprintf(debug_fd, "symbol %s\n", s);
+            TRACE (2, "symbol %s\n", s);
+            }
+        }
+    return 0;
+    }
+
+/* Whether one of the needles occurs in the SIZE bytes at P.  */
+
+static int
+needle_occurs (const unsigned char *p, size_t size)
+    {
+    size_t i;
+
+    if (p == NULL)
+        return 0;
+    for (i = 0; i < nneedles; ++i)
+        if (memmem (p, size, needles[i], needle_lens[i]) != NULL)
+            return 1;
+    return 0;
+    }
+
+/* Whether all include directories of all .debug_line tables already
+   read as they would be written, canonicalized and, with -w, with
+   Windows separators.  Anything not understood counts as no.  */
+
+static int
+line_dirs_unchanged (DSO *dso)
+    {
+    unsigned char *ptr = dso->debug_sections[DEBUG_LINE].data;
+    unsigned char *endsec = ptr + dso->debug_sections[DEBUG_LINE].size;
+    unsigned char *endcu;
+    char *buf = NULL;
+    size_t buf_size = 0, len;
+    int version, ret = 1;
+
+    while (ret && ptr != NULL && ptr < endsec)
+        {
+        ret = 0;
+        if (endsec - ptr < 4)
+            break;
+        endcu = ptr + 4;
+        endcu += read_32 (dso, ptr);
+        if (endcu == ptr + 0xffffffff || endcu > endsec || endcu < ptr + 2)
+            break;
+        version = read_16 (dso, ptr);
+        if (version < 2 || version > 4)
+            break;
+        /* header_length, minimum_instruction_length, maximum operations
+           per instruction from version 4, default_is_stmt, line_base
+           and line_range, then opcode_base and the lengths of the
+           opcodes below it.  */
+        ptr += 4 + 1 + (version >= 4) + 3;
+        if (ptr >= endcu || *ptr == 0)
+            break;
+        ptr += *ptr;
+
+        ret = 1;
+        while (ret && ptr < endcu && *ptr != 0)
+            {
+            len = strnlen ((char *) ptr, endcu - ptr);
+            if (ptr + len == endcu)
+                {
+                ret = 0;
+                break;
+                }
+            if (len + 2 > buf_size)
+                {
+                buf_size = 2 * (len + 2);
+                buf = realloc (buf, buf_size);
+                if (buf == NULL)
+                    error (1, errno, "%s: Could not allocate memory",
+                           dso->filename);
+                }
+            canonicalize_path ((char *) ptr, buf);
+            if ((win_path && memchr (ptr, '/', len) != NULL)
+                    || strcmp ((char *) ptr, buf) != 0)
+                ret = 0;
+            ptr += len + 1;
             }
+        if (ptr >= endcu)
+            ret = 0;
+        ptr = endcu;
+        }
+
+    free (buf);
+    return ret;
+    }
+
+/*
+ * Only paths under a base dir with a dest dir are rewritten, and
+ * beyond that only line table directories are normalized.  So unless a
+ * list file is written or strings are rebuilt regardless, a file none
+ * of the needles occurs in, at the bytes level, and whose directories
+ * are already normal, comes out unchanged and need not be parsed.
+ */
+
+static int
+prefilter_skips (DSO *dso)
+    {
+    struct debug_section *sym = &dso->debug_sections[DEBUG_SYMTAB];
+    Elf_Data *strdata = NULL;
+
+    if (!rewrite_paths || nneedles == 0 || list_file_fd != -1
+            || rebuild_strings)
+        return 0;
+    if (needle_occurs (dso->debug_sections[DEBUG_INFO].data,
+                       dso->debug_sections[DEBUG_INFO].size)
+            || needle_occurs (dso->debug_sections[DEBUG_STR].data,
+                              dso->debug_sections[DEBUG_STR].size)
+            || needle_occurs (dso->debug_sections[DEBUG_LINE].data,
+                              dso->debug_sections[DEBUG_LINE].size))
+        return 0;
+    if (sym->data != NULL)
+        {
+        strdata = elf_getdata (dso->scn[dso->shdr[sym->sec].sh_link], NULL);
+        if (strdata != NULL
+                && needle_occurs (strdata->d_buf, strdata->d_size))
+            return 0;
         }
+    return line_dirs_unchanged (dso);
     }
 
 static int
@@ -1199,18 +3363,21 @@ edit_dwarf2 (DSO *dso)
     {
     Elf_Data *data;
     Elf_Scn *scn;
-    int i, j;
+    int i, j, ret = 0;
 
-    for (i = 0; debug_sections[i].name; ++i)
+    for (i = 0; debug_section_names[i]; ++i)
         {
-        debug_sections[i].data = NULL;
-        debug_sections[i].size = 0;
-        debug_sections[i].sec = 0;
-        debug_sections[i].relsec = 0;
+        dso->debug_sections[i].name = debug_section_names[i];
+        dso->debug_sections[i].data = NULL;
+        dso->debug_sections[i].size = 0;
+        dso->debug_sections[i].sec = 0;
+        dso->debug_sections[i].relsec = 0;
         }
-    ptr_size = 0;
+    dso->ptr_size = 0;
+    dso->rebuild_line = grow_paths;
+    dso->rebuild_str = grow_paths || rebuild_strings;
 
-    /* Record .debug_* sections into debug_sections[] array */
+    /* Record .debug_* sections into dso->debug_sections[] array */
     
     for (i = 1; i < dso->ehdr.e_shnum; ++i)
         if (! (dso->shdr[i].sh_flags & (SHF_ALLOC | SHF_WRITE | SHF_EXECINSTR))
@@ -1229,10 +3396,10 @@ edit_dwarf2 (DSO *dso)
 
             if (strncmp (name, ".debug_", sizeof (".debug_") - 1) == 0)
                 {
-                for (j = 0; debug_sections[j].name; ++j)
-                    if (strcmp (name, debug_sections[j].name) == 0)
+                for (j = 0; dso->debug_sections[j].name; ++j)
+                    if (strcmp (name, dso->debug_sections[j].name) == 0)
                         {
-                        if (debug_sections[j].data)
+                        if (dso->debug_sections[j].data)
                             {
                             error (0, 0, "%s: Found two copies of %s section",
                                    dso->filename, name);
@@ -1245,14 +3412,20 @@ edit_dwarf2 (DSO *dso)
                         assert (elf_getdata (scn, data) == NULL);
                         assert (data->d_off == 0);
                         assert (data->d_size == dso->shdr[i].sh_size);
-                        debug_sections[j].data = data->d_buf;
-                        debug_sections[j].elf_data = data;
-                        debug_sections[j].size = data->d_size;
-                        debug_sections[j].sec = i;
+                        if (!data_in_map (dso, data))
+                            {
+                            error (0, 0, "%s: Cannot edit %s in place",
+                                   dso->filename, name);
+                            return 1;
+                            }
+                        dso->debug_sections[j].data = data->d_buf;
+                        dso->debug_sections[j].elf_data = data;
+                        dso->debug_sections[j].size = data->d_size;
+                        dso->debug_sections[j].sec = i;
                         break;
                         }
 
-                if (debug_sections[j].name == NULL)
+                if (dso->debug_sections[j].name == NULL)
                     {
                     error (0, 0, "%s: Unknown debugging section %s",
                            dso->filename, name);
@@ -1266,29 +3439,27 @@ edit_dwarf2 (DSO *dso)
                              && strncmp (name, ".rela.debug_",
                                          sizeof (".rela.debug_") - 1) == 0)))
                 {
-                for (j = 0; debug_sections[j].name; ++j)
+                for (j = 0; dso->debug_sections[j].name; ++j)
                     if (strcmp (name + sizeof (".rel") - 1
                                 + (dso->shdr[i].sh_type == SHT_RELA),
-                                debug_sections[j].name) == 0)
+                                dso->debug_sections[j].name) == 0)
                         {
-                        debug_sections[j].relsec = i;
+                        dso->debug_sections[j].relsec = i;
                         
-                        fprintf(debug_fd, "Relocation section %d name %s\n", i, name);
+                        TRACE (1, "Relocation section %d name %s\n", i, name);
                         
                         break;
                         }
                 }
             else if (strncmp (name, ".symtab", sizeof (".symtab") - 1) == 0)
                 {
-                fprintf(debug_fd, "########.symtab sec %d\n", i);
+                TRACE (1, "########.symtab sec %d\n", i);
                 scn = dso->scn[i];
                 data = elf_getdata (scn, NULL);
-                debug_sections[DEBUG_SYMTAB].data = data->d_buf;
-                debug_sections[DEBUG_SYMTAB].elf_data = data;
-                debug_sections[DEBUG_SYMTAB].size = data->d_size;
-                debug_sections[DEBUG_SYMTAB].sec = i;
-
-                edit_symtab(dso, data);
+                dso->debug_sections[DEBUG_SYMTAB].data = data->d_buf;
+                dso->debug_sections[DEBUG_SYMTAB].elf_data = data;
+                dso->debug_sections[DEBUG_SYMTAB].size = data->d_size;
+                dso->debug_sections[DEBUG_SYMTAB].sec = i;
                 }
             }
 
@@ -1296,15 +3467,15 @@ edit_dwarf2 (DSO *dso)
     
     if (dso->ehdr.e_ident[EI_DATA] == ELFDATA2LSB)
         {
-        do_read_16 = buf_read_ule16;
-        do_read_32 = buf_read_ule32;
-        write_32 = dwarf2_write_le32;
+        dso->do_read_16 = buf_read_ule16;
+        dso->do_read_32 = buf_read_ule32;
+        dso->write_32 = dwarf2_write_le32;
         }
     else if (dso->ehdr.e_ident[EI_DATA] == ELFDATA2MSB)
         {
-        do_read_16 = buf_read_ube16;
-        do_read_32 = buf_read_ube32;
-        write_32 = dwarf2_write_be32;
+        dso->do_read_16 = buf_read_ube16;
+        dso->do_read_32 = buf_read_ube32;
+        dso->write_32 = dwarf2_write_be32;
         }
     else
         {
@@ -1312,30 +3483,68 @@ edit_dwarf2 (DSO *dso)
         return 1;
         }
 
+    if (prefilter_skips (dso))
+        {
+        TRACE (1, "%s: base dir not found, skipping\n", dso->filename);
+        dso->stats.prefiltered = 1;
+        return 0;
+        }
+
+    if (dso->debug_sections[DEBUG_SYMTAB].data != NULL
+            && edit_symtab (dso, dso->debug_sections[DEBUG_SYMTAB].elf_data))
+        return 1;
+
+    /* Make sure the tables can be rebuilt before anything is edited.
+       Without a longer dest dir rebuilding is only an optimization.  */
+
+    if (dso->rebuild_str)
+        {
+        const char *why = NULL;
+
+        if (dso->ehdr.e_type == ET_REL)
+            why = "in relocatable files";
+        else if (dso->debug_sections[DEBUG_TYPES].data != NULL
+                 || dso->debug_sections[DEBUG_MACRO].data != NULL)
+            why = "alongside .debug_types or .debug_macro";
+        else if (!can_resize_section (dso, dso->debug_sections[DEBUG_STR].sec)
+                 || !can_resize_section (dso, dso->debug_sections[DEBUG_LINE].sec))
+            why = "followed by loaded sections";
+
+        if (why != NULL && grow_paths)
+            {
+            error (0, 0, "%s: Cannot rebuild debug sections %s, dest dir must not be longer than base dir",
+                   dso->filename, why);
+            return 1;
+            }
+        if (why != NULL)
+            dso->rebuild_str = 0;
+        }
+
     /* Edit .debug_info section */
     
-    if (debug_sections[DEBUG_INFO].data != NULL)
+    if (dso->debug_sections[DEBUG_INFO].data != NULL)
         {
         unsigned char *ptr, *endcu, *endsec;
         uint32_t value;
-        htab_t abbrev;
-        struct abbrev_tag tag, *t;
-        int phase;
-        REL *relbuf = NULL;
+        CU *cus = NULL, *cu;
+        size_t ncus = 0, max_cus = 0;
+        int header_failed = 0;
 
         /* Handle Relocation entries */
         
-        if (debug_sections[DEBUG_INFO].relsec)
+        if (dso->debug_sections[DEBUG_INFO].relsec)
             {
             int ndx, maxndx;
             GElf_Rel rel;
             GElf_Rela rela;
             GElf_Sym sym;
-            GElf_Addr base = dso->shdr[debug_sections[DEBUG_INFO].sec].sh_addr;
+            GElf_Addr base = dso->shdr[dso->debug_sections[DEBUG_INFO].sec].sh_addr;
             Elf_Data *symdata = NULL;
-            int rtype;
+            unsigned char *info = dso->debug_sections[DEBUG_INFO].data;
+            size_t info_size = dso->debug_sections[DEBUG_INFO].size;
+            int rtype, nrel = 0;
 
-            i = debug_sections[DEBUG_INFO].relsec;
+            i = dso->debug_sections[DEBUG_INFO].relsec;
             scn = dso->scn[i];
             data = elf_getdata (scn, NULL);
             assert (data != NULL && data->d_buf != NULL);
@@ -1343,10 +3552,14 @@ edit_dwarf2 (DSO *dso)
             assert (data->d_off == 0);
             assert (data->d_size == dso->shdr[i].sh_size);
             maxndx = dso->shdr[i].sh_size / dso->shdr[i].sh_entsize;
-            relbuf = malloc (maxndx * sizeof (REL));
-            reltype = dso->shdr[i].sh_type;
-            if (relbuf == NULL)
+            /* The relocations are applied to a copy of .debug_info, so
+               reads can find their relocated value at the same offset in
+               any order, from any thread, while the section itself is
+               written as it was.  */
+            dso->info_relocated = malloc (info_size);
+            if (dso->info_relocated == NULL)
                 error (1, errno, "%s: Could not allocate memory", dso->filename);
+            memcpy (dso->info_relocated, info, info_size);
 
             symdata = elf_getdata (dso->scn[dso->shdr[i].sh_link], NULL);
             assert (symdata != NULL && symdata->d_buf != NULL);
@@ -1356,7 +3569,7 @@ edit_dwarf2 (DSO *dso)
             assert (symdata->d_size
                     == dso->shdr[dso->shdr[i].sh_link].sh_size);
 
-            for (ndx = 0, relend = relbuf; ndx < maxndx; ++ndx)
+            for (ndx = 0; ndx < maxndx; ++ndx)
                 {
                 if (dso->shdr[i].sh_type == SHT_REL)
                     {
@@ -1374,9 +3587,9 @@ edit_dwarf2 (DSO *dso)
                     continue;
                 /* Only consider relocations against .debug_str, .debug_line
                 and .debug_abbrev.  */
-                if (sym.st_shndx != debug_sections[DEBUG_STR].sec
-                        && sym.st_shndx != debug_sections[DEBUG_LINE].sec
-                        && sym.st_shndx != debug_sections[DEBUG_ABBREV].sec)
+                if (sym.st_shndx != dso->debug_sections[DEBUG_STR].sec
+                        && sym.st_shndx != dso->debug_sections[DEBUG_LINE].sec
+                        && sym.st_shndx != dso->debug_sections[DEBUG_ABBREV].sec)
                     continue;
                 rela.r_addend += sym.st_value;
                 rtype = ELF64_R_TYPE (rela.r_info);
@@ -1411,128 +3624,161 @@ edit_dwarf2 (DSO *dso)
                         break;
                     default:
 fail:
-                        error (1, 0, "%s: Unhandled relocation %d in .debug_info section",
+                        error (0, 0, "%s: Unhandled relocation %d in .debug_info section",
                                dso->filename, rtype);
+                        header_failed = 1;
+                        break;
+                    }
+                if (header_failed)
+                    break;
+                rela.r_offset -= base;
+                if (info_size < 4 || rela.r_offset > info_size - 4)
+                    {
+                    error (0, 0, "%s: Relocation outside .debug_info section",
+                           dso->filename);
+                    header_failed = 1;
+                    break;
                     }
-                relend->ptr = debug_sections[DEBUG_INFO].data
-                              + (rela.r_offset - base);
-                relend->addend = rela.r_addend;
-                ++relend;
+                if (dso->shdr[i].sh_type == SHT_REL)
+                    rela.r_addend += dso->do_read_32 (info + rela.r_offset);
+                dso->write_32 (dso->info_relocated + rela.r_offset,
+                               (uint32_t) rela.r_addend);
+                ++nrel;
                 }
-            if (relbuf == relend)
+            if (nrel == 0)
                 {
-                free (relbuf);
-                relbuf = NULL;
-                relend = NULL;
+                free (dso->info_relocated);
+                dso->info_relocated = NULL;
                 }
-            else
-                qsort (relbuf, relend - relbuf, sizeof (REL), rel_cmp);
             }
 
-        for (phase = 0; phase < 2; phase++)
-            {
-            fprintf(debug_fd, "@@@###@@@phase %d@@@###@@@\n", phase);
-            
-            ptr = debug_sections[DEBUG_INFO].data;
-            relptr = relbuf;
-            endsec = ptr + debug_sections[DEBUG_INFO].size;
+        ptr = dso->debug_sections[DEBUG_INFO].data;
+        endsec = ptr + dso->debug_sections[DEBUG_INFO].size;
 
-            /* Parse the .debug_info data buffer */
-            
-            while (ptr < endsec)
+        /* Parse the CU headers of the .debug_info data buffer, unless
+           the relocations could not be applied.  */
+        
+        while (!header_failed && ptr < endsec)
+            {
+            if (ncus == max_cus)
                 {
-                /* The .debug_info should be at least 11 bytes */
-                
-                if (ptr + 11 > endsec)
-                    {
-                    error (0, 0, "%s: .debug_info CU header too small",
+                max_cus = max_cus ? 2 * max_cus : 64;
+                cus = realloc (cus, max_cus * sizeof (CU));
+                if (cus == NULL)
+                    error (1, errno, "%s: Could not allocate memory",
                            dso->filename);
-                    return 1;
-                    }
+                }
+            cu = &cus[ncus];
+            memset (cu, 0, sizeof (*cu));
 
-                endcu = ptr + 4; 
-                endcu += read_32 (ptr); /* Length - 32 bits */
-                if (endcu == ptr + 0xffffffff)
-                    {
-                    error (0, 0, "%s: 64-bit DWARF not supported", dso->filename);
-                    return 1;
-                    }
+            /* The .debug_info should be at least 11 bytes */
+            
+            if (ptr + 11 > endsec)
+                {
+                error (0, 0, "%s: .debug_info CU header too small",
+                       dso->filename);
+                header_failed = 1;
+                break;
+                }
 
-                if (endcu > endsec)
-                    {
-                    error (0, 0, "%s: .debug_info too small", dso->filename);
-                    return 1;
-                    }
+            endcu = ptr + 4; 
+            endcu += read_32 (dso, ptr); /* Length - 32 bits */
+            if (endcu == ptr + 0xffffffff)
+                {
+                error (0, 0, "%s: 64-bit DWARF not supported", dso->filename);
+                header_failed = 1;
+                break;
+                }
 
-                cu_version = read_16 (ptr); /* Version - 16 bits */
-                if (cu_version != 2 && cu_version != 3 && cu_version != 4)
-                    {
-                    error (0, 0, "%s: DWARF version %d unhandled", dso->filename,
-                           cu_version);
-                    return 1;
-                    }
+            if (endcu > endsec)
+                {
+                error (0, 0, "%s: .debug_info too small", dso->filename);
+                header_failed = 1;
+                break;
+                }
 
-                value = read_32_relocated (ptr); /* Abbrev Offset - 32 bits */
-                if (value >= debug_sections[DEBUG_ABBREV].size)
-                    {
-                    if (debug_sections[DEBUG_ABBREV].data == NULL)
-                        error (0, 0, "%s: .debug_abbrev not present", dso->filename);
-                    else
-                        error (0, 0, "%s: DWARF CU abbrev offset too large",
-                               dso->filename);
-                    return 1;
-                    }
+            cu->version = read_16 (dso, ptr); /* Version - 16 bits */
+            if (cu->version != 2 && cu->version != 3 && cu->version != 4)
+                {
+                error (0, 0, "%s: DWARF version %d unhandled", dso->filename,
+                       cu->version);
+                header_failed = 1;
+                break;
+                }
 
-                if (ptr_size == 0)
-                    {
-                    ptr_size = read_1 (ptr); /* Pointer Size - 8 bits */
-                    if (ptr_size != 4 && ptr_size != 8)
-                        {
-                        error (0, 0, "%s: Invalid DWARF pointer size %d",
-                               dso->filename, ptr_size);
-                        return 1;
-                        }
-                    }
-                else if (read_1 (ptr) != ptr_size) /* Pointer Size - 8 bits */
-                    {
-                    error (0, 0, "%s: DWARF pointer size differs between CUs",
+            value = read_32_relocated (dso, ptr); /* Abbrev Offset - 32 bits */
+            if (value >= dso->debug_sections[DEBUG_ABBREV].size)
+                {
+                if (dso->debug_sections[DEBUG_ABBREV].data == NULL)
+                    error (0, 0, "%s: .debug_abbrev not present", dso->filename);
+                else
+                    error (0, 0, "%s: DWARF CU abbrev offset too large",
                            dso->filename);
-                    return 1;
-                    }
-                
-                /* Read from .debug_abbrev section at Abbrev Offset */
-                
-                abbrev = read_abbrev (dso,
-                                      debug_sections[DEBUG_ABBREV].data + value);
-                if (abbrev == NULL)
-                    return 1;
+                header_failed = 1;
+                break;
+                }
 
-                while (ptr < endcu)
+            if (dso->ptr_size == 0)
+                {
+                dso->ptr_size = read_1 (ptr); /* Pointer Size - 8 bits */
+                if (dso->ptr_size != 4 && dso->ptr_size != 8)
                     {
-                    tag.entry = read_uleb128 (ptr);
-                    if (tag.entry == 0)
-                        continue;
-                    t = htab_find_with_hash (abbrev, &tag, tag.entry);
-                    if (t == NULL)
-                        {
-                        error (0, 0, "%s: Could not find DWARF abbreviation %d",
-                               dso->filename, tag.entry);
-                        htab_delete (abbrev);
-                        return 1;
-                        }
-
-                    ptr = edit_attributes (dso, ptr, t, phase);
-                    if (ptr == NULL)
-                        break;
+                    error (0, 0, "%s: Invalid DWARF pointer size %d",
+                           dso->filename, dso->ptr_size);
+                    header_failed = 1;
+                    break;
                     }
-
-                htab_delete (abbrev);
                 }
+            else if (read_1 (ptr) != dso->ptr_size) /* Pointer Size - 8 bits */
+                {
+                error (0, 0, "%s: DWARF pointer size differs between CUs",
+                       dso->filename);
+                header_failed = 1;
+                break;
+                }
+            
+            /* Read from .debug_abbrev section at Abbrev Offset */
+            
+            cu->abbrev = get_abbrev (dso, value);
+            if (cu->abbrev == NULL)
+                {
+                header_failed = 1;
+                break;
+                }
+
+            cu->ptr = ptr;
+            cu->end = endcu;
+            ++ncus;
+            ptr = endcu;
+            }
+
+        ret = process_cus (dso, cus, ncus, header_failed);
+        if (ret == 0 && dso->rebuild_line)
+            ret = rebuild_debug_line (dso, cus, ncus);
+        if (ret == 0 && dso->rebuild_str)
+            ret = rebuild_debug_str (dso, cus, ncus);
+        if (dso->debug_sections[DEBUG_LINE].rebuilt
+                || dso->debug_sections[DEBUG_STR].rebuilt)
+            relayout_sections (dso);
+        if (dso->str_rewrites != NULL)
+            {
+            htab_delete (dso->str_rewrites);
+            dso->str_rewrites = NULL;
             }
-        free (relbuf);
+        free (dso->str_seen);
+        dso->str_seen = NULL;
+        if (dso->line_tables != NULL)
+            {
+            htab_delete (dso->line_tables);
+            dso->line_tables = NULL;
+            }
+        free_cus (dso, cus, ncus);
+        free_abbrev_cache (dso);
+        free (dso->info_relocated);
+        dso->info_relocated = NULL;
         }
 
-    return 0;
+    return ret;
     }
 
 static struct poptOption optionsTable[] =
@@ -1542,28 +3788,64 @@ static struct poptOption optionsTable[] =
         "base build directory of objects", NULL
         },
         {
-        "dest-dir",  'd', POPT_ARG_STRING, &dest_dir, 0,
-        "directory to rewrite base-dir into", NULL
+        "dest-dir",  'd', POPT_ARG_STRING, &dest_dir, 0,
+        "directory to rewrite base-dir into", NULL
+        },
+        {
+        "map-file", '\0', POPT_ARG_STRING, &map_file, 0,
+        "file of BASE=DEST lines, each rewriting BASE into DEST like -b and -d; the longest matching BASE applies", "FILE"
+        },
+        {
+        "list-file", 'l', POPT_ARG_STRING, &list_file, 0,
+        "file where to put list of source and header file names", NULL
+        },
+        {
+        "win-path",  'w', POPT_ARG_NONE, &win_path, 0,
+        "change the path delimiter to be Windows compatible", NULL
+        },
+        {
+        "use-newline",  'n', POPT_ARG_NONE, &use_newline, 0,
+        "separate strings in the list file with \\n, not \\0", NULL
+        },
+        {
+        "files-only", 'f', POPT_ARG_NONE, &list_only_files, 0,
+        "do not include directories into the list file", NULL
+        },
+        {
+        "sort-list", '\0', POPT_ARG_NONE, &sort_list, 0,
+        "write the list file sorted rather than in the order found", NULL
+        },
+        {
+        "strings-first", '\0', POPT_ARG_NONE, &strings_first, 0,
+        "rewrite the .debug_str strings of the unit DIEs in a parallel scan of the section after the walk; not with -w, -r or a longer dest dir", NULL
+        },
+        {
+        "quiet", 'q', POPT_ARG_NONE, &be_quiet, 0,
+        "quiet mode, do  not write anything to standard output", NULL
+        },
+        {
+        "verbose", 'v', POPT_ARG_NONE, NULL, 'v',
+        "trace what is edited to standard output; -vv for every line table entry and symbol", NULL
         },
         {
-        "list-file", 'l', POPT_ARG_STRING, &list_file, 0,
-        "file where to put list of source and header file names", NULL
+        "stats", 's', POPT_ARG_NONE, &show_stats, 0,
+        "print processing statistics to standard error", NULL
         },
         {
-        "win-path",  'w', POPT_ARG_NONE, &win_path, 0,
-        "change the path delimiter to be Windows compatible", NULL
+        "all-dies", 'a', POPT_ARG_NONE, &all_dies, 0,
+        "walk every DIE, not just the unit DIE of each CU", NULL
         },
         {
-        "use-newline",  'n', POPT_ARG_NONE, &use_newline, 0,
-        "separate strings in the list file with \\n, not \\0", NULL
+        "mmap", 'm', POPT_ARG_NONE, &in_place, 0,
+        "edit a mapping of the file and write back only the edited sections instead of rewriting it", NULL
         },
         {
-        "files-only", 'f', POPT_ARG_NONE, &list_only_files, 0,
-        "do not include directories into the list file", NULL
+        "rebuild-strings", 'r', POPT_ARG_NONE, &rebuild_strings, 0,
+        "rebuild .debug_str, merging identical strings and shared suffixes", NULL
         },
         {
-        "quiet", 'q', POPT_ARG_NONE, &be_quiet, 0,
-        "quiet mode, do  not write anything to standard output", NULL
+        "jobs", 'j', POPT_ARG_INT, &num_jobs, 0,
+        "process files, or the CUs of a single file, with N threads", "N"
         },
     POPT_AUTOHELP
         { NULL, 0, 0, NULL, 0, NULL, NULL }
@@ -1576,8 +3858,42 @@ fdopen_dso (int fd, const char *name, int readonly)
     GElf_Ehdr ehdr;
     int i;
     DSO *dso = NULL;
+    void *map = NULL;
+    size_t map_size = 0;
 
-    elf = elf_begin (fd, (readonly == 0) ? ELF_C_RDWR : ELF_C_READ, NULL);
+    if (in_place && !grow_paths && !rebuild_strings)
+        {
+        /* Unless the tables get rebuilt, no section ever changes size,
+           so the edits can simply be made to the mapped pages.  They
+           are private to us, so that nothing reaches the file unless
+           all of it is edited; write_back_map then writes the edited
+           sections, and libelf has nothing to write out.  */
+        struct stat st;
+
+        if (fstat (fd, &st) < 0)
+            {
+            error (0, errno, "cannot map \"%s\"", name);
+            goto error_out;
+            }
+        if (st.st_size == 0)
+            {
+            error (0, 0, "cannot map \"%s\": file is empty", name);
+            goto error_out;
+            }
+        map_size = st.st_size;
+        map = mmap (NULL, map_size,
+                    (readonly == 0) ? PROT_READ | PROT_WRITE : PROT_READ,
+                    MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED)
+            {
+            map = NULL;
+            error (0, errno, "cannot map \"%s\"", name);
+            goto error_out;
+            }
+        elf = elf_memory ((char *) map, map_size);
+        }
+    else
+        elf = elf_begin (fd, (readonly == 0) ? ELF_C_RDWR : ELF_C_READ, NULL);
     if (elf == NULL)
         {
         error (0, 0, "cannot open ELF file: %s", elf_errmsg (-1));
@@ -1619,6 +3935,8 @@ fdopen_dso (int fd, const char *name, int readonly)
     memset (dso, 0, sizeof(DSO));
     dso->elf = elf;
     dso->ehdr = ehdr;
+    dso->map = map;
+    dso->map_size = map_size;
     dso->scn = (Elf_Scn **) &dso->shdr[ehdr.e_shnum + 20];
 
     for (i = 0; i < ehdr.e_shnum; ++i)
@@ -1638,28 +3956,392 @@ error_out:
         }
     if (elf)
         elf_end (elf);
+    if (map)
+        munmap (map, map_size);
     if (fd != -1)
         close (fd);
     return NULL;
     }
 
+/* With -m, write the sections edited in the mapping of DSO back to FD,
+   at the offsets they were mapped from.  Return -1 with errno set if
+   that fails.  */
+
+static int
+write_back_map (DSO *dso, int fd)
+    {
+    unsigned char *map = (unsigned char *) dso->map;
+    int i;
+
+    for (i = 1; i < dso->ehdr.e_shnum; i++)
+        {
+        Elf_Data *data;
+        unsigned char *buf;
+        size_t size;
+
+        if (dso->shdr[i].sh_type == SHT_NOBITS
+                || (data = elf_getdata (dso->scn[i], NULL)) == NULL
+                || (elf_flagdata (data, ELF_C_SET, 0) & ELF_F_DIRTY) == 0
+                || !data_in_map (dso, data))
+            continue;
+
+        for (buf = data->d_buf, size = data->d_size; size > 0; )
+            {
+            ssize_t n = pwrite (fd, buf, size, buf - map);
+
+            if (n < 0)
+                {
+                if (errno == EINTR)
+                    continue;
+                return -1;
+                }
+            buf += n;
+            size -= n;
+            }
+        }
+    return 0;
+    }
+
+/* What editing a file came to.  A file none of whose paths needed
+   rewriting is left alone entirely, and counts as unchanged.  */
+
+#define EDIT_CHANGED 0
+#define EDIT_UNCHANGED 1
+#define EDIT_FAILED 2
+
+static const char *const edit_outcomes[] = { "edited", "unchanged", "failed" };
+
+/* A file to edit, and what editing it produced for the list file and
+   for -s.  These are reported in the order the files were given, not
+   the order they were finished in.  */
+
+typedef struct
+    {
+    char *name;
+    int done;
+    int outcome;
+    LIST list;
+    unsigned long abbrev_hits, abbrev_misses, line_repeats;
+    unsigned long path_hits, path_misses;
+    unsigned long arena_allocs, arena_blocks;
+    int prefiltered;
+    } INPUT;
+
+struct batch
+    {
+    INPUT *inputs;
+    size_t ninputs, max_inputs;
+    size_t reported;
+    int readonly;
+    pthread_mutex_t lock;
+    };
+
+/* Edit the file IN names, returning one of the EDIT_* outcomes.  */
+
+static int
+edit_file (INPUT *in, int readonly)
+    {
+    DSO *dso;
+    int fd, i, ret = EDIT_UNCHANGED, failed = 0;
+    const char *file = in->name;
+    struct stat stat_buf;
+    int need_chmod;
+
+    if (stat(file, &stat_buf) < 0)
+        {
+        fprintf (stderr, "Failed to open input file '%s': %s\n", file, strerror(errno));
+        return EDIT_FAILED;
+        }
+
+    /* Make sure we can read and write */
+    
+    need_chmod = readonly == 0
+                 && (stat_buf.st_mode & (S_IRUSR | S_IWUSR)) != (S_IRUSR | S_IWUSR);
+    if (need_chmod)
+       chmod (file, stat_buf.st_mode | S_IRUSR | S_IWUSR);
+
+    fd = open (file, (readonly == 0) ? O_RDWR : O_RDONLY);
+    if (fd < 0)
+        {
+        fprintf (stderr, "Failed to open input file '%s': %s\n", file, strerror(errno));
+        ret = EDIT_FAILED;
+        goto restore;
+        }
+
+    dso = fdopen_dso (fd, file, readonly);
+    if (dso == NULL)
+        {
+        ret = EDIT_FAILED;
+        goto restore;
+        }
+
+    for (i = 1; i < dso->ehdr.e_shnum; i++)
+        {
+        const char *name;
+        name = strptr (dso, dso->ehdr.e_shstrndx, dso->shdr[i].sh_name);
+        
+        TRACE (1, "sh:%d, sh_type: %d, sh_name: %s\n", i, dso->shdr[i].sh_type, name);
+        
+        switch (dso->shdr[i].sh_type)
+            {
+            case SHT_PROGBITS:
+                
+                /* TODO: Handle stabs */
+                if (strcmp (name, ".stab") == 0)
+                    {
+                    fprintf (stderr, "Stabs debuginfo not supported: %s\n", file);
+                    break;
+                    }
+                
+                if (strcmp (name, ".debug_info") == 0
+                        && edit_dwarf2 (dso) != 0)
+                    failed = 1;
+
+                break;
+            default:
+                break;
+            }
+        }
+
+    /* A file nothing was edited in need not be written at all.  A file
+       that failed is not written either, with or without -m, rather
+       than leaving it partly rewritten.  */
+    if (failed)
+        ret = EDIT_FAILED;
+    else if (dso->dirty_elf)
+        ret = EDIT_CHANGED;
+    if (readonly == 0 && !failed && dso->map != NULL && dso->dirty_elf
+            && write_back_map (dso, fd) < 0)
+        {
+        fprintf (stderr, "Failed to write file '%s': %s\n", file, strerror (errno));
+        ret = EDIT_FAILED;
+        }
+    if (readonly == 0 && !failed && dso->map == NULL && dso->dirty_elf
+            && elf_update (dso->elf, ELF_C_WRITE) < 0)
+        {
+        fprintf (stderr, "Failed to write file '%s': %s\n", file, elf_errmsg (elf_errno()));
+        ret = EDIT_FAILED;
+        }
+    
+    if (elf_end (dso->elf) < 0)
+        {
+        fprintf (stderr, "elf_end failed: %s\n", elf_errmsg (elf_errno()));
+        ret = EDIT_FAILED;
+        }
+
+    if (dso->map)
+        munmap (dso->map, dso->map_size);
+    
+    close (fd);
+
+    for (i = 0; i < NUM_DEBUG_SECTIONS; i++)
+        if (dso->debug_sections[i].rebuilt)
+            free (dso->debug_sections[i].data);
+
+    in->list = dso->list;
+    in->abbrev_hits = dso->stats.abbrev_hits;
+    in->abbrev_misses = dso->stats.abbrev_misses;
+    in->line_repeats = dso->stats.line_repeats;
+    in->path_hits = dso->stats.path_hits;
+    in->path_misses = dso->stats.path_misses;
+    in->arena_allocs = dso->stats.arena_allocs;
+    in->arena_blocks = dso->stats.arena_blocks;
+    in->prefiltered = dso->stats.prefiltered;
+    free ((char *) dso->filename);
+    free (dso);
+
+restore:
+    /* Restore old access rights */
+    if (need_chmod)
+        chmod (file, stat_buf.st_mode);
+
+    return ret;
+    }
+
+static void
+report_input (INPUT *in)
+    {
+    if (in->list.len && list_file_fd != -1)
+        emit_list (in->list.buf, in->list.len);
+    free (in->list.buf);
+    in->list.buf = NULL;
+
+    if (show_stats)
+        fprintf (stderr, "%s: %s%s; abbrev cache: %lu hits, %lu misses; "
+                 "%lu repeated line tables skipped; "
+                 "path cache: %lu hits, %lu misses; "
+                 "arenas: %lu allocations from %lu blocks\n",
+                 in->name, edit_outcomes[in->outcome],
+                 in->prefiltered ? " (prefiltered)" : "",
+                 in->abbrev_hits, in->abbrev_misses, in->line_repeats,
+                 in->path_hits, in->path_misses,
+                 in->arena_allocs, in->arena_blocks);
+    }
+
+static void
+edit_file_item (size_t i, void *data)
+    {
+    struct batch *b = (struct batch *) data;
+    INPUT *in = &b->inputs[i];
+
+    in->outcome = edit_file (in, b->readonly);
+
+    pthread_mutex_lock (&b->lock);
+    in->done = 1;
+    while (b->reported < b->ninputs && b->inputs[b->reported].done)
+        report_input (&b->inputs[b->reported++]);
+    pthread_mutex_unlock (&b->lock);
+    }
+
+static void
+add_input (struct batch *b, const char *name, size_t len)
+    {
+    INPUT *in;
+
+    if (b->ninputs == b->max_inputs)
+        {
+        b->max_inputs = b->max_inputs ? 2 * b->max_inputs : 16;
+        b->inputs = realloc (b->inputs, b->max_inputs * sizeof (INPUT));
+        if (b->inputs == NULL)
+            error (1, errno, "Could not allocate memory");
+        }
+    in = &b->inputs[b->ninputs++];
+    memset (in, 0, sizeof (*in));
+    in->name = strndup (name, len);
+    if (in->name == NULL)
+        error (1, errno, "Could not allocate memory");
+    }
+
+/* Add the names read from FILE, or from standard input if FILE is
+   NULL, separated by SEP.  Empty names are ignored.  */
+
+static int
+read_input_list (struct batch *b, const char *file, int sep)
+    {
+    FILE *f = file ? fopen (file, "r") : stdin;
+    char *line = NULL;
+    size_t n = 0;
+    ssize_t len;
+    int ret = 0;
+
+    if (f == NULL)
+        return -1;
+
+    while ((len = getdelim (&line, &n, sep, f)) > 0)
+        {
+        if (line[len - 1] == sep)
+            --len;
+        if (len > 0)
+            add_input (b, line, len);
+        }
+    if (ferror (f))
+        ret = -1;
+
+    free (line);
+    if (f != stdin)
+        fclose (f);
+    return ret;
+    }
+
+/* DIR with SLASH appended, unless it already ends in '/'.  */
+
+static char *
+dir_with_slash (const char *dir, const char *slash)
+    {
+    size_t len = strlen (dir);
+    char *p = malloc (len + 2);
+
+    if (p == NULL)
+        error (1, errno, "Could not allocate memory");
+    memcpy (p, dir, len + 1);
+    if (len == 0 || dir[len - 1] != '/')
+        strcpy (p + len, slash);
+    return p;
+    }
+
+/* Add the rule rewriting BASE to DEST, or only recognizing BASE for the
+   list file if DEST is NULL.  */
+
+static void
+add_path_rule (const char *base, const char *dest)
+    {
+    char *b = dir_with_slash (base, "/");
+    char *d = dest ? dir_with_slash (dest, win_path ? "\\" : "/") : NULL;
+
+    if (path_map == NULL && (path_map = pathmap_create ()) == NULL)
+        error (1, ENOMEM, "Could not allocate memory");
+    if (pathmap_add (path_map, b, d) < 0)
+        {
+        if (errno != EEXIST)
+            error (1, errno, "Could not allocate memory");
+        fprintf (stderr, "Base dir %s is mapped more than once\n", b);
+        exit (1);
+        }
+    free (b);
+    free (d);
+    }
+
+/* Add the rules in map file FILE, one BASE=DEST per line.  Empty lines
+   and lines starting with '#' are ignored.  */
+
+static int
+read_map_file (const char *file)
+    {
+    FILE *f = fopen (file, "r");
+    char *line = NULL, *eq;
+    size_t n = 0;
+    ssize_t len;
+    unsigned int lineno = 0;
+    int ret = 0;
+
+    if (f == NULL)
+        return -1;
+
+    while ((len = getline (&line, &n, f)) > 0)
+        {
+        ++lineno;
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+            line[--len] = '\0';
+        if (len == 0 || line[0] == '#')
+            continue;
+
+        eq = strchr (line, '=');
+        if (eq == NULL || eq == line || eq[1] == '\0')
+            {
+            fprintf (stderr, "%s:%u: Expected BASE=DEST\n", file, lineno);
+            exit (1);
+            }
+        *eq = '\0';
+        add_path_rule (line, eq + 1);
+        }
+    if (ferror (f))
+        ret = -1;
+
+    free (line);
+    fclose (f);
+    return ret;
+    }
+
 int
 main (int argc, char *argv[])
     {
-    DSO *dso;
-    int fd, i, readonly;
-    const char *file;
+    struct batch batch;
+    int i, ret;
+    size_t n;
+    unsigned long outcomes[3];
+    size_t ndest = 0, common_len = 0;
     poptContext optCon;   /* context for parsing command-line options */
     int nextopt;
     const char **args;
-    struct stat stat_buf;
-    char *p;
 
     debug_fd = stdout;
+    pathscan_init ();
     optCon = poptGetContext("debugedit", argc, (const char **)argv, optionsTable, 0);
+    poptSetOtherOptionHelp (optCon, "[OPTION...] FILE... | @LISTFILE | -");
 
     while ((nextopt = poptGetNextOpt (optCon)) > 0 || nextopt == POPT_ERROR_BADOPT)
-        /* do nothing */ ;
+        if (nextopt == 'v')
+            verbose++;
 
     if (nextopt != -1)
         {
@@ -1671,21 +4353,14 @@ main (int argc, char *argv[])
         }
 
     args = poptGetArgs (optCon);
-    if (args == NULL || args[0] == NULL || args[1] != NULL)
+    if (args == NULL || args[0] == NULL)
         {
         poptPrintHelp(optCon, stdout, 0);
         exit (1);
         }
 
     if (be_quiet != 0)
-        {
-        debug_fd = fopen("/dev/null", "w");
-        if (debug_fd == NULL)
-            {
-            fprintf (stderr, "Can't open /dev/null\n");
-            exit (1);
-            }
-        }
+        verbose = 0;
 
     if (dest_dir != NULL)
         {
@@ -1694,126 +4369,140 @@ main (int argc, char *argv[])
             fprintf (stderr, "You must specify a base dir if you specify a dest dir\n");
             exit (1);
             }
-        if (strlen (dest_dir) > strlen (base_dir))
-            {
-            fprintf (stderr, "Dest dir longer than base dir is not supported\n");
-            exit (1);
-            }
         }
 
-    if (dest_dir == NULL && base_dir == NULL && win_path == 0)
+    memset (&batch, 0, sizeof (batch));
+
+    if (dest_dir == NULL && base_dir == NULL && map_file == NULL
+            && win_path == 0 && rebuild_strings == 0)
         {
-        readonly = 1;
+        batch.readonly = 1;
         }
    else
         {
-        readonly = 0;
+        batch.readonly = 0;
         }
 
-    /* Make sure there are trailing slashes in dirs */
-    
-    if (base_dir != NULL && base_dir[strlen (base_dir)-1] != '/')
-        {
-        p = malloc (strlen (base_dir) + 2);
-        strcpy (p, base_dir);
-        strcat (p, "/");
-        free (base_dir);
-        base_dir = p;
-        }
-    
-    if (dest_dir != NULL && dest_dir[strlen (dest_dir)-1] != '/')
+    /* Collect the -b/-d pair and the map file rules, with trailing
+       slashes in all dirs.  */
+
+    if (base_dir != NULL)
+        add_path_rule (base_dir, dest_dir);
+    if (map_file != NULL && read_map_file (map_file) < 0)
         {
-        p = malloc (strlen (dest_dir) + 2);
-        strcpy (p, dest_dir);
-        if (win_path)
-            strcat (p, "\\");
-        else
-            strcat (p, "/");
-        free (dest_dir);
-        dest_dir = p;
+        fprintf (stderr, "Failed to read map file '%s': %s\n",
+                 map_file, strerror (errno));
+        exit (1);
         }
 
-    if (list_file != NULL)
+    /* A longer dest dir only fits by rebuilding the tables the paths are
+       kept in.  */
+    for (n = 0; path_map != NULL && n < pathmap_size (path_map); n++)
         {
-        list_file_fd = open (list_file, O_WRONLY|O_CREAT|O_APPEND, 0644);
+        const struct path_rule *r = pathmap_rule (path_map, n);
+
+        if (r->dest == NULL)
+            continue;
+        rewrite_paths = 1;
+        if (r->dest_len > max_dest_len)
+            max_dest_len = r->dest_len;
+        if (r->dest_len > r->base_len)
+            grow_paths = 1;
         }
 
-    file = args[0];
+    if (strings_first && rewrite_paths
+            && (win_path || rebuild_strings || grow_paths))
+        error (0, 0, "--strings-first does not apply with -w, -r or a longer dest dir; .debug_str is rewritten through the unit DIEs");
 
-    if (elf_version(EV_CURRENT) == EV_NONE)
+    /* Search for the base dirs with a dest dir, or for what they all
+       start with if there are many.  */
+    for (n = 0; rewrite_paths && n < pathmap_size (path_map); n++)
         {
-        fprintf (stderr, "library out of date\n");
-        exit (1);
-        }
+        const struct path_rule *r = pathmap_rule (path_map, n);
+        size_t k;
 
-    if (stat(file, &stat_buf) < 0)
+        if (r->dest == NULL)
+            continue;
+        if (nneedles < MAX_NEEDLES)
+            {
+            needles[nneedles] = r->base;
+            needle_lens[nneedles++] = r->base_len;
+            }
+        if (ndest++ == 0)
+            common_len = r->base_len;
+        for (k = 0; k < common_len && needles[0][k] == r->base[k]; k++)
+            ;
+        common_len = k;
+        }
+    if (ndest > MAX_NEEDLES)
         {
-        fprintf (stderr, "Failed to open input file '%s': %s\n", file, strerror(errno));
-        exit (1);
+        needle_lens[0] = common_len;
+        nneedles = common_len > 1 ? 1 : 0;
         }
 
-    /* Make sure we can read and write */
-    
-    if (readonly == 0)
-       chmod (file, stat_buf.st_mode | S_IRUSR | S_IWUSR);
-
-    fd = open (file, (readonly == 0) ? O_RDWR : O_RDONLY);
-    if (fd < 0)
+    if (list_file != NULL)
         {
-        fprintf (stderr, "Failed to open input file '%s': %s\n", file, strerror(errno));
-        exit (1);
+        list_file_fd = open (list_file, O_WRONLY|O_CREAT|O_APPEND, 0644);
         }
 
-    dso = fdopen_dso (fd, file, readonly);
-    if (dso == NULL)
-        exit (1);
+    /* Files to edit are named on the command line, one per line in an
+       @LISTFILE, or NUL separated on standard input for "-".  */
 
-    for (i = 1; i < dso->ehdr.e_shnum; i++)
+    for (i = 0; args[i] != NULL; i++)
         {
-        const char *name;
-        name = strptr (dso, dso->ehdr.e_shstrndx, dso->shdr[i].sh_name);
-        
-        fprintf (debug_fd, "sh:%d, sh_type: %d, sh_name: %s\n", i, dso->shdr[i].sh_type, name);
-        
-        switch (dso->shdr[i].sh_type)
+        const char *list = NULL;
+
+        if (strcmp (args[i], "-") == 0)
+            ret = read_input_list (&batch, NULL, '\0');
+        else if (args[i][0] == '@')
+            ret = read_input_list (&batch, list = args[i] + 1, '\n');
+        else
             {
-            case SHT_PROGBITS:
-                
-                /* TODO: Handle stabs */
-                if (strcmp (name, ".stab") == 0)
-                    {
-                    fprintf (stderr, "Stabs debuginfo not supported: %s\n", file);
-                    break;
-                    }
-                
-                if (strcmp (name, ".debug_info") == 0)
-                    edit_dwarf2 (dso);
+            add_input (&batch, args[i], strlen (args[i]));
+            ret = 0;
+            }
 
-                break;
-            default:
-                break;
+        if (ret < 0)
+            {
+            fprintf (stderr, "Failed to read file list '%s': %s\n",
+                     list ? list : "-", strerror(errno));
+            exit (1);
             }
         }
 
-    if (readonly == 0 && elf_update (dso->elf, ELF_C_WRITE) < 0)
+    if (elf_version(EV_CURRENT) == EV_NONE)
         {
-        fprintf (stderr, "Failed to write file: %s\n", elf_errmsg (elf_errno()));
+        fprintf (stderr, "library out of date\n");
         exit (1);
         }
-    
-    if (elf_end (dso->elf) < 0)
+
+    /* With several files, spread the files over the threads rather than
+       the CUs of each file.  */
+    cu_jobs = batch.ninputs > 1 ? 1 : num_jobs;
+
+    pthread_mutex_init (&batch.lock, NULL);
+    workq_run (batch.ninputs, num_jobs, edit_file_item, &batch);
+    pthread_mutex_destroy (&batch.lock);
+
+    if (list_file_fd != -1)
+        finish_list_file ();
+
+    memset (outcomes, 0, sizeof (outcomes));
+    for (n = 0; n < batch.ninputs; n++)
         {
-        fprintf (stderr, "elf_end failed: %s\n", elf_errmsg (elf_errno()));
-        exit (1);
+        outcomes[batch.inputs[n].outcome]++;
+        free (batch.inputs[n].name);
         }
-    
-    close (fd);
+    free (batch.inputs);
 
-    /* Restore old access rights */
-    if (readonly == 0)
-        chmod (file, stat_buf.st_mode);
+    if (show_stats)
+        fprintf (stderr, "%lu edited, %lu unchanged, %lu failed\n",
+                 outcomes[EDIT_CHANGED], outcomes[EDIT_UNCHANGED],
+                 outcomes[EDIT_FAILED]);
+    ret = outcomes[EDIT_FAILED] != 0;
 
+    pathmap_delete (path_map);
     poptFreeContext (optCon);
 
-    return 0;
+    return ret;
     }
@@ -26,10 +26,13 @@ Boston, MA 02111-1307, USA.  */
    The size of the table is not fixed; if the occupancy of the table
    grows too high the hash table will be expanded.
 
-   The abstract data implementation is based on generalized Algorithm D
-   from Knuth's book "The art of computer programming".  Hash table is
-   expanded by creation of new hash table and transferring elements from
-   the old table to the new table. */
+   The table size is a power of two.  Hash values are spread over it by
+   multiplication and collisions are resolved by linear probing.  The
+   hash value of every entry is kept next to it, so a probe only calls
+   the comparison function when the hash values match, and expanding
+   the table never calls the hash function.  Hash values that follow
+   each other, such as dense integer keys, do not end up in adjacent
+   slots as they would in a table indexed modulo a prime.  */
 
 #include <sys/types.h>
 #include <stdlib.h>
@@ -46,9 +49,13 @@ Boston, MA 02111-1307, USA.  */
 
 #define DELETED_ENTRY  ((void *) 1)
 
-static unsigned long higher_prime_number (unsigned long);
+/* The smallest table.  */
+
+#define MIN_SIZE 8
+
 static hashval_t hash_pointer (const void *);
 static int eq_pointer (const void *, const void *);
+static int htab_alloc_entries (htab_t, size_t);
 static int htab_expand (htab_t);
 static void **find_empty_slot_for_expand  (htab_t, hashval_t);
 
@@ -58,71 +65,17 @@ static void **find_empty_slot_for_expand  (htab_t, hashval_t);
 htab_hash htab_hash_pointer = hash_pointer;
 htab_eq htab_eq_pointer = eq_pointer;
 
-/* The following function returns a nearest prime number which is
-   greater than N, and near a power of two. */
+/* The index where the search for HASH starts.  Multiplying by the
+   golden ratio mixes all bits of HASH into the top ones, which are the
+   ones kept, so that hash values that only differ in their high bits,
+   such as section offsets, still spread over a small table.  */
 
-static unsigned long
-higher_prime_number (n)
-unsigned long n;
+static inline size_t
+htab_index (htab, hash)
+htab_t htab;
+hashval_t hash;
     {
-    /* These are primes that are near, but slightly smaller than, a
-       power of two.  */
-    static unsigned long primes[] =
-        {
-        (unsigned long) 2,
-        (unsigned long) 7,
-        (unsigned long) 13,
-        (unsigned long) 31,
-        (unsigned long) 61,
-        (unsigned long) 127,
-        (unsigned long) 251,
-        (unsigned long) 509,
-        (unsigned long) 1021,
-        (unsigned long) 2039,
-        (unsigned long) 4093,
-        (unsigned long) 8191,
-        (unsigned long) 16381,
-        (unsigned long) 32749,
-        (unsigned long) 65521,
-        (unsigned long) 131071,
-        (unsigned long) 262139,
-        (unsigned long) 524287,
-        (unsigned long) 1048573,
-        (unsigned long) 2097143,
-        (unsigned long) 4194301,
-        (unsigned long) 8388593,
-        (unsigned long) 16777213,
-        (unsigned long) 33554393,
-        (unsigned long) 67108859,
-        (unsigned long) 134217689,
-        (unsigned long) 268435399,
-        (unsigned long) 536870909,
-        (unsigned long) 1073741789,
-        (unsigned long) 2147483647,
-        /* 4294967291L */
-        ((unsigned long) 2147483647) + ((unsigned long) 2147483644),
-        };
-
-    unsigned long* low = &primes[0];
-    unsigned long* high = &primes[sizeof(primes) / sizeof(primes[0])];
-
-    while (low != high)
-        {
-        unsigned long* mid = low + (high - low) / 2;
-        if (n > *mid)
-            low = mid + 1;
-        else
-            high = mid;
-        }
-
-    /* If we've run out of primes, abort.  */
-    if (n > *low)
-        {
-        fprintf (stderr, "Cannot find prime bigger than %lu\n", n);
-        abort ();
-        }
-
-    return *low;
+    return (hashval_t) (hash * 0x9e3779b9U) >> htab->shift;
     }
 
 /* Returns a hash code for P.  */
@@ -144,33 +97,66 @@ const void * p2;
     return p1 == p2;
     }
 
+/* Give HTAB empty entries for a table of the smallest power of two
+   entries, at least MIN_SIZE, that is not smaller than SIZE.  The entry
+   pointers and hash values are allocated in one block, the pointers
+   first.  Return zero if memory allocation fails.  */
+
+static int
+htab_alloc_entries (htab, size)
+htab_t htab;
+size_t size;
+    {
+    size_t n = MIN_SIZE;
+    unsigned int shift = 32 - 3;     /* 32 - log2 (MIN_SIZE) */
+    void **entries;
+
+    while (n < size)
+        {
+        n *= 2;
+        shift--;
+        }
+
+    entries = (void **) (*htab->alloc_f) (n, sizeof (void *)
+                                             + sizeof (hashval_t));
+    if (entries == NULL)
+        return 0;
+
+    htab->entries = entries;
+    htab->hashes = (hashval_t *) (entries + n);
+    htab->size = n;
+    htab->shift = shift;
+    return 1;
+    }
+
 /* This function creates table with length slightly longer than given
    source length.  The created hash table is initiated as empty (all the
    hash table entries are EMPTY_ENTRY).  The function returns the created
    hash table.  Memory allocation may fail; it may return NULL.  */
 
 htab_t
-htab_try_create (size, hash_f, eq_f, del_f)
+htab_create_alloc (size, hash_f, eq_f, del_f, alloc_f, free_f)
 size_t size;
 htab_hash hash_f;
 htab_eq eq_f;
 htab_del del_f;
+htab_alloc alloc_f;
+htab_free free_f;
     {
     htab_t result;
 
-    size = higher_prime_number (size);
-    result = (htab_t) calloc (1, sizeof (struct htab));
+    result = (htab_t) (*alloc_f) (1, sizeof (struct htab));
     if (result == NULL)
         return NULL;
 
-    result->entries = (void **) calloc (size, sizeof (void *));
-    if (result->entries == NULL)
+    result->alloc_f = alloc_f;
+    result->free_f = free_f;
+    if (!htab_alloc_entries (result, size))
         {
-        free (result);
+        (*free_f) (result);
         return NULL;
         }
 
-    result->size = size;
     result->hash_f = hash_f;
     result->eq_f = eq_f;
     result->del_f = del_f;
@@ -178,6 +164,18 @@ htab_del del_f;
     return result;
     }
 
+/* Like htab_create_alloc, with calloc and free.  */
+
+htab_t
+htab_try_create (size, hash_f, eq_f, del_f)
+size_t size;
+htab_hash hash_f;
+htab_eq eq_f;
+htab_del del_f;
+    {
+    return htab_create_alloc (size, hash_f, eq_f, del_f, calloc, free);
+    }
+
 /* This function frees all memory allocated for given hash table.
    Naturally the hash table must already exist. */
 
@@ -185,16 +183,16 @@ void
 htab_delete (htab)
 htab_t htab;
     {
-    int i;
+    size_t i;
 
     if (htab->del_f)
-        for (i = htab->size - 1; i >= 0; i--)
+        for (i = 0; i < htab->size; i++)
             if (htab->entries[i] != EMPTY_ENTRY
                     && htab->entries[i] != DELETED_ENTRY)
                 (*htab->del_f) (htab->entries[i]);
 
-    free (htab->entries);
-    free (htab);
+    (*htab->free_f) (htab->entries);
+    (*htab->free_f) (htab);
     }
 
 /* This function clears all entries in the given hash table.  */
@@ -203,15 +201,17 @@ void
 htab_empty (htab)
 htab_t htab;
     {
-    int i;
+    size_t i;
 
     if (htab->del_f)
-        for (i = htab->size - 1; i >= 0; i--)
+        for (i = 0; i < htab->size; i++)
             if (htab->entries[i] != EMPTY_ENTRY
                     && htab->entries[i] != DELETED_ENTRY)
                 (*htab->del_f) (htab->entries[i]);
 
     memset (htab->entries, 0, htab->size * sizeof (void *));
+    htab->n_elements = 0;
+    htab->n_deleted = 0;
     }
 
 /* Similar to htab_find_slot, but without several unwanted side effects:
@@ -226,74 +226,58 @@ find_empty_slot_for_expand (htab, hash)
 htab_t htab;
 hashval_t hash;
     {
-    size_t size = htab->size;
-    hashval_t hash2 = 1 + hash % (size - 2);
-    unsigned int index = hash % size;
+    size_t mask = htab->size - 1;
+    size_t index = htab_index (htab, hash);
 
     for (;;)
         {
         void **slot = htab->entries + index;
 
         if (*slot == EMPTY_ENTRY)
+            {
+            htab->hashes[index] = hash;
             return slot;
+            }
         else if (*slot == DELETED_ENTRY)
             abort ();
 
-        index += hash2;
-        if (index >= size)
-            index -= size;
+        index = (index + 1) & mask;
         }
     }
 
 /* The following function changes size of memory allocated for the
    entries and repeatedly inserts the table elements.  The occupancy
-   of the table after the call will be about 50%.  Naturally the hash
-   table must already exist.  Remember also that the place of the
-   table entries is changed.  If memory allocation failures are allowed,
-   this function will return zero, indicating that the table could not be
-   expanded.  If all goes well, it will return a non-zero value.  */
+   of the table after the call will be at most 50%, and the deleted
+   entries are gone.  Naturally the hash table must already exist.
+   Remember also that the place of the table entries is changed.  If
+   memory allocation failures are allowed, this function will return
+   zero, indicating that the table could not be expanded.  If all goes
+   well, it will return a non-zero value.  */
 
 static int
 htab_expand (htab)
 htab_t htab;
     {
-    void **oentries;
-    void **olimit;
-    void **p;
-
-    oentries = htab->entries;
-    olimit = oentries + htab->size;
+    void **oentries = htab->entries;
+    hashval_t *ohashes = htab->hashes;
+    size_t osize = htab->size;
+    size_t i;
 
-    htab->size = higher_prime_number (htab->size * 2);
-
-    if (htab->return_allocation_failure)
-        {
-        void **nentries = (void **) calloc (htab->size, sizeof (void **));
-        if (nentries == NULL)
-            return 0;
-        htab->entries = nentries;
-        }
+    if (!htab_alloc_entries (htab, 2 * (htab->n_elements - htab->n_deleted) + 1))
+        return 0;
 
     htab->n_elements -= htab->n_deleted;
     htab->n_deleted = 0;
 
-    p = oentries;
-    do
+    for (i = 0; i < osize; i++)
         {
-        void * x = *p;
+        void * x = oentries[i];
 
         if (x != EMPTY_ENTRY && x != DELETED_ENTRY)
-            {
-            void **q = find_empty_slot_for_expand (htab, (*htab->hash_f) (x));
-
-            *q = x;
-            }
-
-        p++;
+            *find_empty_slot_for_expand (htab, ohashes[i]) = x;
         }
-    while (p < olimit);
 
-    free (oentries);
+    (*htab->free_f) (oentries);
     return 1;
     }
 
@@ -306,33 +290,23 @@ htab_t htab;
 const void * element;
 hashval_t hash;
     {
-    unsigned int index;
-    hashval_t hash2;
-    size_t size;
+    size_t mask = htab->size - 1;
+    size_t index = htab_index (htab, hash);
     void * entry;
 
     htab->searches++;
-    size = htab->size;
-    index = hash % size;
-
-    entry = htab->entries[index];
-    if (entry == EMPTY_ENTRY
-            || (entry != DELETED_ENTRY && (*htab->eq_f) (entry, element)))
-        return entry;
-
-    hash2 = 1 + hash % (size - 2);
 
     for (;;)
         {
-        htab->collisions++;
-        index += hash2;
-        if (index >= size)
-            index -= size;
-
         entry = htab->entries[index];
-        if (entry == EMPTY_ENTRY
-                || (entry != DELETED_ENTRY && (*htab->eq_f) (entry, element)))
+        if (entry == EMPTY_ENTRY)
+            return entry;
+        if (entry != DELETED_ENTRY && htab->hashes[index] == hash
+                && (*htab->eq_f) (entry, element))
             return entry;
+
+        htab->collisions++;
+        index = (index + 1) & mask;
         }
     }
 
@@ -351,9 +325,9 @@ const void * element;
    equal to the given element.  To delete an entry, call this with
    INSERT = 0, then call htab_clear_slot on the slot returned (possibly
    after doing some checks).  To insert an entry, call this with
-   INSERT = 1, then write the value you want into the returned slot.
-   When inserting an entry, NULL may be returned if memory allocation
-   fails.  */
+   INSERT = 1, then write the value you want into the returned slot;
+   its hash value must be HASH.  When inserting an entry, NULL may be
+   returned if memory allocation fails.  */
 
 void **
 htab_find_slot_with_hash (htab, element, hash, insert)
@@ -362,21 +336,17 @@ const void * element;
 hashval_t hash;
 enum insert_option insert;
     {
-    void **first_deleted_slot;
-    unsigned int index;
-    hashval_t hash2;
-    size_t size;
+    size_t first_deleted = (size_t) -1;
+    size_t index, mask;
 
-    if (insert == INSERT && htab->size * 3 <= htab->n_elements * 4
+    if (insert == INSERT && htab->size * 3 <= (htab->n_elements + 1) * 4
             && htab_expand (htab) == 0)
         return NULL;
 
-    size = htab->size;
-    hash2 = 1 + hash % (size - 2);
-    index = hash % size;
+    mask = htab->size - 1;
+    index = htab_index (htab, hash);
 
     htab->searches++;
-    first_deleted_slot = NULL;
 
     for (;;)
         {
@@ -386,29 +356,30 @@ enum insert_option insert;
             if (insert == NO_INSERT)
                 return NULL;
 
-            htab->n_elements++;
-
-            if (first_deleted_slot)
+            if (first_deleted != (size_t) -1)
                 {
-                *first_deleted_slot = EMPTY_ENTRY;
-                return first_deleted_slot;
+                index = first_deleted;
+                htab->entries[index] = EMPTY_ENTRY;
+                htab->n_deleted--;
                 }
+            else
+                htab->n_elements++;
 
+            htab->hashes[index] = hash;
             return &htab->entries[index];
             }
 
         if (entry == DELETED_ENTRY)
             {
-            if (!first_deleted_slot)
-                first_deleted_slot = &htab->entries[index];
+            if (first_deleted == (size_t) -1)
+                first_deleted = index;
             }
-        else  if ((*htab->eq_f) (entry, element))
+        else if (htab->hashes[index] == hash
+                 && (*htab->eq_f) (entry, element))
             return &htab->entries[index];
 
         htab->collisions++;
-        index += hash2;
-        if (index >= size)
-            index -= size;
+        index = (index + 1) & mask;
         }
     }
 
@@ -437,7 +408,7 @@ void * element;
     void **slot;
 
     slot = htab_find_slot (htab, element, NO_INSERT);
-    if (*slot == EMPTY_ENTRY)
+    if (slot == NULL)
         return;
 
     if (htab->del_f)
@@ -24,10 +24,13 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.  */
    The size of the table is not fixed; if the occupancy of the table
    grows too high the hash table will be expanded.
 
-   The abstract data implementation is based on generalized Algorithm D
-   from Knuth's book "The art of computer programming".  Hash table is
-   expanded by creation of new hash table and transferring elements from
-   the old table to the new table.  */
+   The table size is a power of two.  Hash values are spread over it by
+   multiplication and collisions are resolved by linear probing.  The
+   hash value of every entry is kept next to it, so a probe only calls
+   the comparison function when the hash values match, and expanding
+   the table never calls the hash function.  Hash values that follow
+   each other, such as dense integer keys, do not end up in adjacent
+   slots as they would in a table indexed modulo a prime.  */
 
 #ifndef __HASHTAB_H__
 #define __HASHTAB_H__
@@ -55,6 +58,13 @@ typedef int (*htab_eq) (const void *, const void *);
    the hash table.  */
 typedef void (*htab_del) (void *);
 
+/* Memory allocation and deallocation, calloc-like and free-like.  They
+   allocate the table header and the array of slots, whose entry
+   pointers and hash values come in one block.  The entries the slots
+   point to belong to the caller.  */
+typedef void *(*htab_alloc) (size_t, size_t);
+typedef void (*htab_free) (void *);
+
 /* Function called by htab_traverse for each live element.  The first
    arg is the slot of the element (which can be passed to htab_clear_slot
    if desired), the second arg is the auxiliary pointer handed to
@@ -80,8 +90,13 @@ struct htab
     /* Table itself.  */
     void **entries;
 
-    /* Current size (in entries) of the hash table */
+    /* The hash value of each entry in ENTRIES.  */
+    hashval_t *hashes;
+
+    /* Current size (in entries) of the hash table, a power of two, and
+       the shift that turns a scrambled hash value into an index.  */
     size_t size;
+    unsigned int shift;
 
     /* Current number of elements including also deleted elements */
     size_t n_elements;
@@ -100,6 +115,10 @@ struct htab
     /* This is non-zero if we are allowed to return NULL for function calls
        that allocate memory.  */
     int return_allocation_failure;
+
+    /* Pointers to allocate and free the table.  */
+    htab_alloc alloc_f;
+    htab_free free_f;
     };
 
 typedef struct htab *htab_t;
@@ -113,6 +132,11 @@ enum insert_option {NO_INSERT, INSERT};
    allocation fails, and also signals that htab_find_slot_with_hash and
    htab_find_slot are allowed to return NULL when inserting.  */
 extern htab_t	htab_try_create	(size_t, htab_hash, htab_eq, htab_del);
+
+/* Like htab_try_create, but allocating the table with the given
+   functions.  */
+extern htab_t	htab_create_alloc (size_t, htab_hash, htab_eq, htab_del,
+                                   htab_alloc, htab_free);
 extern void	htab_delete	(htab_t);
 extern void	htab_empty	(htab_t);
 
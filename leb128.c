@@ -0,0 +1,159 @@
+/* LEB128 decoding.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.  */
+
+#include <string.h>
+#include "leb128.h"
+
+/* Where at least eight bytes are left, they are loaded as one word.
+   The byte ending the number is the first without its top bit set, and
+   the seven low bits of the bytes before it are packed together with a
+   few shifts and masks instead of a loop.  Numbers of more than eight
+   bytes, and those near END, are finished a byte at a time.  */
+
+#define STOP_BITS 0x8080808080808080ULL
+
+static inline uint64_t
+load_le64 (const unsigned char *p)
+    {
+    uint64_t w;
+
+    memcpy (&w, p, sizeof (w));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    w = __builtin_bswap64 (w);
+#endif
+    return w;
+    }
+
+static inline uint64_t
+pack7 (uint64_t w)
+    {
+    w &= 0x7f7f7f7f7f7f7f7fULL;
+    w = (w & 0x007f007f007f007fULL) | ((w & 0x7f007f007f007f00ULL) >> 1);
+    w = (w & 0x00003fff00003fffULL) | ((w & 0x3fff00003fff0000ULL) >> 2);
+    w = (w & 0x000000000fffffffULL) | ((w & 0x0fffffff00000000ULL) >> 4);
+    return w;
+    }
+
+/* Decode the number at *PP into *VAL, its low 64 bits, set *SHIFT to
+   the number of bits it was encoded in, up to 70, and *OVERFLOW if any
+   of those beyond 64 were set.  Returns 0 if it runs into END.  */
+
+static int
+decode (unsigned char **pp, const unsigned char *end, uint64_t *val,
+        unsigned int *shift, int *overflow)
+    {
+    unsigned char *p = *pp;
+    uint64_t v = 0;
+    unsigned int s = 0;
+    unsigned char c;
+
+    *overflow = 0;
+    if (end - p >= 8)
+        {
+        uint64_t w = load_le64 (p);
+        uint64_t stops = ~w & STOP_BITS;
+
+        if (stops != 0)
+            {
+            unsigned int n = __builtin_ctzll (stops) / 8 + 1;
+
+            if (n < 8)
+                w &= ((uint64_t) 1 << (8 * n)) - 1;
+            *pp = p + n;
+            *val = pack7 (w);
+            *shift = 7 * n;
+            return 1;
+            }
+        v = pack7 (w);
+        s = 56;
+        p += 8;
+        }
+
+    do
+        {
+        if (p >= end)
+            {
+            *pp = (unsigned char *) end;
+            return 0;
+            }
+        c = *p++;
+        if (s < 64)
+            {
+            v |= (uint64_t) (c & 0x7f) << s;
+            if (s == 63 && (c & 0x7e) != 0)
+                *overflow = 1;
+            s += 7;
+            }
+        else if ((c & 0x7f) != 0)
+            *overflow = 1;
+        }
+    while (c & 0x80);
+
+    *pp = p;
+    *val = v;
+    *shift = s;
+    return 1;
+    }
+
+uint64_t
+leb128_read_u_slow (unsigned char **pp, const unsigned char *end)
+    {
+    unsigned int shift;
+    int overflow;
+    uint64_t val;
+
+    if (!decode (pp, end, &val, &shift, &overflow) || overflow)
+        return LEB128_ERROR;
+    return val;
+    }
+
+int64_t
+leb128_read_s_slow (unsigned char **pp, const unsigned char *end)
+    {
+    unsigned int shift;
+    int overflow;
+    uint64_t val;
+
+    if (!decode (pp, end, &val, &shift, &overflow))
+        return SLEB128_ERROR;
+    if (shift < 64 && ((*pp)[-1] & 0x40) != 0)
+        val |= -((uint64_t) 1 << shift);
+    return (int64_t) val;
+    }
+
+void
+leb128_skip_slow (unsigned char **pp, const unsigned char *end)
+    {
+    unsigned char *p = *pp;
+
+    for (; end - p >= 8; p += 8)
+        {
+        uint64_t stops = ~load_le64 (p) & STOP_BITS;
+
+        if (stops != 0)
+            {
+            *pp = p + __builtin_ctzll (stops) / 8 + 1;
+            return;
+            }
+        }
+    while (p < end)
+        if (*p++ < 0x80)
+            {
+            *pp = p;
+            return;
+            }
+    *pp = (unsigned char *) end;
+    }
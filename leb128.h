@@ -0,0 +1,102 @@
+/* LEB128 decoding.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.  */
+
+/* The readers decode the number at *PP, advance *PP past it and never
+   look at END or beyond.  Most numbers in DWARF, such as abbreviation
+   codes, attributes, forms and file indexes, take one or two bytes, and
+   those are decoded inline; longer ones are left to leb128.c.
+
+   A number that runs into END leaves *PP at END.  The unsigned reader
+   then returns LEB128_ERROR, as it also does for a number too large for
+   64 bits; the signed reader returns SLEB128_ERROR, and drops the bits
+   of a number too large for 64 bits.  */
+
+#ifndef __LEB128_H__
+#define __LEB128_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#define LEB128_ERROR UINT64_MAX
+#define SLEB128_ERROR INT64_MIN
+
+extern uint64_t	leb128_read_u_slow (unsigned char **, const unsigned char *);
+extern int64_t	leb128_read_s_slow (unsigned char **, const unsigned char *);
+extern void	leb128_skip_slow (unsigned char **, const unsigned char *);
+
+static inline uint64_t
+leb128_read_u (unsigned char **pp, const unsigned char *end)
+    {
+    unsigned char *p = *pp;
+
+    if (__builtin_expect (end - p >= 2, 1))
+        {
+        if (p[0] < 0x80)
+            {
+            *pp = p + 1;
+            return p[0];
+            }
+        if (p[1] < 0x80)
+            {
+            *pp = p + 2;
+            return (p[0] & 0x7f) | (p[1] << 7);
+            }
+        }
+    return leb128_read_u_slow (pp, end);
+    }
+
+static inline int64_t
+leb128_read_s (unsigned char **pp, const unsigned char *end)
+    {
+    unsigned char *p = *pp;
+
+    if (__builtin_expect (end - p >= 2, 1))
+        {
+        if (p[0] < 0x80)
+            {
+            *pp = p + 1;
+            return (int64_t) ((uint64_t) p[0] << 57) >> 57;
+            }
+        if (p[1] < 0x80)
+            {
+            *pp = p + 2;
+            return (int64_t) ((uint64_t) ((p[0] & 0x7f) | (p[1] << 7)) << 50)
+                   >> 50;
+            }
+        }
+    return leb128_read_s_slow (pp, end);
+    }
+
+/* Advance *PP past the number there, signed or not.  */
+static inline void
+leb128_skip (unsigned char **pp, const unsigned char *end)
+    {
+    unsigned char *p = *pp;
+
+    if (__builtin_expect (p < end && p[0] < 0x80, 1))
+        *pp = p + 1;
+    else
+        leb128_skip_slow (pp, end);
+    }
+
+#ifdef __cplusplus
+    }
+#endif /* __cplusplus */
+
+#endif /* __LEB128_H__ */
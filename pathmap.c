@@ -0,0 +1,225 @@
+/* Prefix rules for rewriting paths.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.  */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pathmap.h"
+
+/* One byte of a trie.  The children of a node are chained through
+   SIBLING; RULE is the rule whose prefix ends here, or -1.  Node 0 is
+   the root and stands for the empty prefix.  */
+
+struct trie_node
+    {
+    unsigned char c;
+    int child;
+    int sibling;
+    int rule;
+    };
+
+struct trie
+    {
+    struct trie_node *nodes;
+    size_t n, max;
+    };
+
+struct path_map
+    {
+    struct path_rule *rules;
+    size_t n, max;
+    struct trie base, dest;
+    };
+
+static int
+trie_new_node (struct trie *t, unsigned char c)
+    {
+    if (t->n == t->max)
+        {
+        size_t max = t->max ? 2 * t->max : 64;
+        struct trie_node *nodes = realloc (t->nodes, max * sizeof (*nodes));
+
+        if (nodes == NULL)
+            return -1;
+        t->nodes = nodes;
+        t->max = max;
+        }
+    t->nodes[t->n].c = c;
+    t->nodes[t->n].child = -1;
+    t->nodes[t->n].sibling = -1;
+    t->nodes[t->n].rule = -1;
+    return t->n++;
+    }
+
+/* The node for prefix S, created if need be, or -1 if out of memory.  */
+
+static int
+trie_insert (struct trie *t, const char *s)
+    {
+    int node = 0, next;
+
+    if (t->n == 0 && trie_new_node (t, 0) < 0)
+        return -1;
+
+    for (; *s; ++s)
+        {
+        for (next = t->nodes[node].child; next != -1;
+             next = t->nodes[next].sibling)
+            if (t->nodes[next].c == (unsigned char) *s)
+                break;
+        if (next == -1)
+            {
+            next = trie_new_node (t, *s);
+            if (next < 0)
+                return -1;
+            t->nodes[next].sibling = t->nodes[node].child;
+            t->nodes[node].child = next;
+            }
+        node = next;
+        }
+    return node;
+    }
+
+/* The rule of the longest prefix of S in T, or -1.  */
+
+static int
+trie_match (const struct trie *t, const char *s)
+    {
+    int node = 0, rule = -1;
+
+    if (t->n == 0)
+        return -1;
+
+    for (; *s; ++s)
+        {
+        for (node = t->nodes[node].child; node != -1;
+             node = t->nodes[node].sibling)
+            if (t->nodes[node].c == (unsigned char) *s)
+                break;
+        if (node == -1)
+            break;
+        if (t->nodes[node].rule != -1)
+            rule = t->nodes[node].rule;
+        }
+    return rule;
+    }
+
+path_map_t
+pathmap_create (void)
+    {
+    return calloc (1, sizeof (struct path_map));
+    }
+
+void
+pathmap_delete (path_map_t map)
+    {
+    size_t i;
+
+    if (map == NULL)
+        return;
+    for (i = 0; i < map->n; ++i)
+        {
+        free ((char *) map->rules[i].base);
+        free ((char *) map->rules[i].dest);
+        }
+    free (map->rules);
+    free (map->base.nodes);
+    free (map->dest.nodes);
+    free (map);
+    }
+
+int
+pathmap_add (path_map_t map, const char *base, const char *dest)
+    {
+    struct path_rule *r;
+    int bnode, dnode = -1;
+
+    bnode = trie_insert (&map->base, base);
+    if (bnode < 0)
+        goto nomem;
+    if (map->base.nodes[bnode].rule != -1)
+        {
+        errno = EEXIST;
+        return -1;
+        }
+    if (dest != NULL)
+        {
+        dnode = trie_insert (&map->dest, dest);
+        if (dnode < 0)
+            goto nomem;
+        }
+
+    if (map->n == map->max)
+        {
+        size_t max = map->max ? 2 * map->max : 16;
+        struct path_rule *rules = realloc (map->rules, max * sizeof (*rules));
+
+        if (rules == NULL)
+            goto nomem;
+        map->rules = rules;
+        map->max = max;
+        }
+    r = &map->rules[map->n];
+    r->base = strdup (base);
+    r->dest = dest ? strdup (dest) : NULL;
+    if (r->base == NULL || (dest != NULL && r->dest == NULL))
+        {
+        free ((char *) r->base);
+        free ((char *) r->dest);
+        goto nomem;
+        }
+    r->base_len = strlen (base);
+    r->dest_len = dest ? strlen (dest) : 0;
+
+    map->base.nodes[bnode].rule = map->n;
+    /* Two rules may share a dest dir; either will do for stripping it.  */
+    if (dnode >= 0 && map->dest.nodes[dnode].rule == -1)
+        map->dest.nodes[dnode].rule = map->n;
+    map->n++;
+    return 0;
+
+nomem:
+    errno = ENOMEM;
+    return -1;
+    }
+
+const struct path_rule *
+pathmap_match (path_map_t map, const char *s)
+    {
+    int rule = trie_match (&map->base, s);
+
+    return rule < 0 ? NULL : &map->rules[rule];
+    }
+
+const struct path_rule *
+pathmap_match_dest (path_map_t map, const char *s)
+    {
+    int rule = trie_match (&map->dest, s);
+
+    return rule < 0 ? NULL : &map->rules[rule];
+    }
+
+size_t
+pathmap_size (path_map_t map)
+    {
+    return map->n;
+    }
+
+const struct path_rule *
+pathmap_rule (path_map_t map, size_t i)
+    {
+    return &map->rules[i];
+    }
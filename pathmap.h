@@ -0,0 +1,62 @@
+/* Prefix rules for rewriting paths.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.  */
+
+/* A path map holds rules mapping a base dir prefix to a dest dir
+   prefix.  The base dirs, and separately the dest dirs, are kept in a
+   byte trie, so the longest rule matching a string is found in a single
+   scan of its leading bytes, however many rules there are.  */
+
+#ifndef __PATHMAP_H__
+#define __PATHMAP_H__
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+struct path_rule
+    {
+    const char *base;
+    const char *dest;   /* NULL if BASE is only to be recognized.  */
+    size_t base_len;
+    size_t dest_len;
+    };
+
+typedef struct path_map *path_map_t;
+
+/* Create an empty map, or return NULL if out of memory.  */
+extern path_map_t	pathmap_create	(void);
+extern void	pathmap_delete	(path_map_t);
+
+/* Add a copy of the rule mapping BASE to DEST, which may be NULL.
+   Return 0, or -1 with errno set to EEXIST if BASE already has a rule,
+   or to ENOMEM.  Rules returned earlier may move when one is added.  */
+extern int	pathmap_add	(path_map_t, const char *, const char *);
+
+/* The rule with the longest base dir, respectively dest dir, that the
+   string starts with, or NULL.  */
+extern const struct path_rule *pathmap_match (path_map_t, const char *);
+extern const struct path_rule *pathmap_match_dest (path_map_t, const char *);
+
+extern size_t	pathmap_size	(path_map_t);
+extern const struct path_rule *pathmap_rule (path_map_t, size_t);
+
+#ifdef __cplusplus
+    }
+#endif /* __cplusplus */
+
+#endif /* __PATHMAP_H__ */
@@ -0,0 +1,223 @@
+/* Vectorized scans over path strings.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.  */
+
+#include <stdint.h>
+#include "pathscan.h"
+
+#if defined (__x86_64__) || defined (__i386__)
+#define PATHSCAN_X86 1
+#include <immintrin.h>
+#endif
+
+static const char *
+find_slash_run_scalar (const char *s)
+    {
+    for (; *s; ++s)
+        if (s[0] == '/' && (s[1] == '/' || s[1] == '.'))
+            break;
+    return s;
+    }
+
+static void
+path_to_win_scalar (char *s)
+    {
+    for (; *s; ++s)
+        if (*s == '/')
+            *s = '\\';
+    }
+
+#ifdef PATHSCAN_X86
+
+/*
+ * The scans load whole aligned blocks, so they never touch a page the
+ * string does not reach into, but they do read past its NUL, which the
+ * sanitizers are told to overlook.  The bytes of the first block before
+ * the string are masked out.  Bit I of the masks stands for byte I of
+ * the block, and a run is found where a '/' bit is followed by a '/' or
+ * '.' bit, the '/' possibly being the last byte of the previous block.
+ * The conversion only stores blocks that lie wholly within the string,
+ * and patches the '/'s at either end one by one.
+ */
+
+#define NO_SANITIZE __attribute__ ((no_sanitize_address, no_sanitize_thread))
+
+__attribute__ ((target ("sse2"))) NO_SANITIZE static const char *
+find_slash_run_sse2 (const char *s)
+    {
+    const __m128i slash = _mm_set1_epi8 ('/');
+    const __m128i dot = _mm_set1_epi8 ('.');
+    const __m128i zero = _mm_setzero_si128 ();
+    unsigned int off = (uintptr_t) s & 15;
+    const char *p = s - off;
+    unsigned int valid = ~0u << off, carry = 0;
+
+    for (;; p += 16, valid = ~0u)
+        {
+        __m128i v = _mm_load_si128 ((const __m128i *) p);
+        unsigned int sl = _mm_movemask_epi8 (_mm_cmpeq_epi8 (v, slash));
+        unsigned int sd = sl | _mm_movemask_epi8 (_mm_cmpeq_epi8 (v, dot));
+        unsigned int nul = _mm_movemask_epi8 (_mm_cmpeq_epi8 (v, zero));
+        unsigned int hit;
+
+        sl &= valid;
+        sd &= valid;
+        nul &= valid;
+        hit = ((sl << 1) | carry) & sd;
+        if (nul)
+            hit &= (nul & -nul) - 1;
+        if (hit)
+            return p + __builtin_ctz (hit) - 1;
+        if (nul)
+            return p + __builtin_ctz (nul);
+        carry = (sl >> 15) & 1;
+        }
+    }
+
+__attribute__ ((target ("sse2"))) NO_SANITIZE static void
+path_to_win_sse2 (char *s)
+    {
+    const __m128i slash = _mm_set1_epi8 ('/');
+    const __m128i bslash = _mm_set1_epi8 ('\\');
+    const __m128i zero = _mm_setzero_si128 ();
+    unsigned int off = (uintptr_t) s & 15;
+    char *p = s - off;
+    unsigned int valid = 0xffff << off;
+
+    for (;; p += 16, valid = 0xffff)
+        {
+        __m128i v = _mm_load_si128 ((const __m128i *) p);
+        __m128i m = _mm_cmpeq_epi8 (v, slash);
+        unsigned int sl = _mm_movemask_epi8 (m) & valid;
+        unsigned int nul = _mm_movemask_epi8 (_mm_cmpeq_epi8 (v, zero)) & valid;
+
+        if (nul == 0 && valid == 0xffff)
+            {
+            if (sl)
+                _mm_store_si128 ((__m128i *) p,
+                                 _mm_or_si128 (_mm_andnot_si128 (m, v),
+                                               _mm_and_si128 (m, bslash)));
+            continue;
+            }
+        if (nul)
+            sl &= (nul & -nul) - 1;
+        for (; sl; sl &= sl - 1)
+            p[__builtin_ctz (sl)] = '\\';
+        if (nul)
+            return;
+        }
+    }
+
+/* The AVX2 kernels are not picked by pathscan_init: on paths of the
+   length a build tree has, most of them fit in one or two 32-byte
+   blocks, and the SSE2 kernels are faster there.  They are kept for
+   the bench, which checks and times them.  */
+
+#define AVX2_UNUSED __attribute__ ((unused))
+
+__attribute__ ((target ("avx2"))) NO_SANITIZE AVX2_UNUSED static const char *
+find_slash_run_avx2 (const char *s)
+    {
+    const __m256i slash = _mm256_set1_epi8 ('/');
+    const __m256i dot = _mm256_set1_epi8 ('.');
+    const __m256i zero = _mm256_setzero_si256 ();
+    unsigned int off = (uintptr_t) s & 31;
+    const char *p = s - off;
+    unsigned int valid = ~0u << off, carry = 0;
+
+    for (;; p += 32, valid = ~0u)
+        {
+        __m256i v = _mm256_load_si256 ((const __m256i *) p);
+        unsigned int sl = _mm256_movemask_epi8 (_mm256_cmpeq_epi8 (v, slash));
+        unsigned int sd = sl | _mm256_movemask_epi8 (_mm256_cmpeq_epi8 (v, dot));
+        unsigned int nul = _mm256_movemask_epi8 (_mm256_cmpeq_epi8 (v, zero));
+        unsigned int hit;
+
+        sl &= valid;
+        sd &= valid;
+        nul &= valid;
+        hit = ((sl << 1) | carry) & sd;
+        if (nul)
+            hit &= (nul & -nul) - 1;
+        if (hit)
+            return p + __builtin_ctz (hit) - 1;
+        if (nul)
+            return p + __builtin_ctz (nul);
+        carry = sl >> 31;
+        }
+    }
+
+__attribute__ ((target ("avx2"))) NO_SANITIZE AVX2_UNUSED static void
+path_to_win_avx2 (char *s)
+    {
+    const __m256i slash = _mm256_set1_epi8 ('/');
+    const __m256i bslash = _mm256_set1_epi8 ('\\');
+    const __m256i zero = _mm256_setzero_si256 ();
+    unsigned int off = (uintptr_t) s & 31;
+    char *p = s - off;
+    unsigned int valid = ~0u << off;
+
+    for (;; p += 32, valid = ~0u)
+        {
+        __m256i v = _mm256_load_si256 ((const __m256i *) p);
+        __m256i m = _mm256_cmpeq_epi8 (v, slash);
+        unsigned int sl = _mm256_movemask_epi8 (m) & valid;
+        unsigned int nul = _mm256_movemask_epi8 (_mm256_cmpeq_epi8 (v, zero)) & valid;
+
+        if (nul == 0 && valid == ~0u)
+            {
+            if (sl)
+                _mm256_store_si256 ((__m256i *) p,
+                                    _mm256_blendv_epi8 (v, bslash, m));
+            continue;
+            }
+        if (nul)
+            sl &= (nul & -nul) - 1;
+        for (; sl; sl &= sl - 1)
+            p[__builtin_ctz (sl)] = '\\';
+        if (nul)
+            return;
+        }
+    }
+
+#endif /* PATHSCAN_X86 */
+
+static const char *(*find_slash_run_fn) (const char *) = find_slash_run_scalar;
+static void (*path_to_win_fn) (char *) = path_to_win_scalar;
+
+void
+pathscan_init (void)
+    {
+#ifdef PATHSCAN_X86
+    __builtin_cpu_init ();
+    if (__builtin_cpu_supports ("sse2"))
+        {
+        find_slash_run_fn = find_slash_run_sse2;
+        path_to_win_fn = path_to_win_sse2;
+        }
+#endif
+    }
+
+const char *
+find_slash_run (const char *s)
+    {
+    return find_slash_run_fn (s);
+    }
+
+void
+path_to_win (char *s)
+    {
+    path_to_win_fn (s);
+    }
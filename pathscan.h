@@ -0,0 +1,43 @@
+/* Vectorized scans over path strings.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.  */
+
+/* The byte loops over paths, with SSE2 versions picked at run time on
+   x86 and plain C everywhere else.  pathscan_init must be
+   called once before any thread uses them.  */
+
+#ifndef __PATHSCAN_H__
+#define __PATHSCAN_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/* Select the kernels for the CPU we run on.  */
+extern void	pathscan_init	(void);
+
+/* The first '/' in S that is followed by another '/' or by a '.', or
+   the terminating NUL if there is none.  Past such a point a path may
+   need canonicalizing; before it, it cannot.  */
+extern const char *find_slash_run (const char *);
+
+/* Replace every '/' in S by '\\'.  */
+extern void	path_to_win	(char *);
+
+#ifdef __cplusplus
+    }
+#endif /* __cplusplus */
+
+#endif /* __PATHSCAN_H__ */
@@ -0,0 +1,197 @@
+/* A minimal work-stealing thread pool.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.  */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include "workq.h"
+
+/* The items not yet started by one thread.  Padded so that two threads
+   pulling from their own slices do not share a cache line.  NEXT and END
+   only change under LOCK, but are peeked at without it by thieves, so
+   they are always accessed atomically.  */
+
+struct slice
+    {
+    pthread_mutex_t lock;
+    size_t next;
+    size_t end;
+    char pad[64];
+    };
+
+#define LOAD(x) __atomic_load_n (&(x), __ATOMIC_RELAXED)
+#define STORE(x, v) __atomic_store_n (&(x), (v), __ATOMIC_RELAXED)
+
+struct workq
+    {
+    struct slice *slices;
+    int nthreads;
+    workq_fn fn;
+    void *data;
+    };
+
+struct worker
+    {
+    struct workq *q;
+    int id;
+    };
+
+/* Take the next item of slice S into *ITEM.  Returns zero if S is
+   empty.  */
+
+static int
+take (struct slice *s, size_t *item)
+    {
+    int ret = 0;
+
+    pthread_mutex_lock (&s->lock);
+    if (LOAD (s->next) < LOAD (s->end))
+        {
+        *item = LOAD (s->next);
+        STORE (s->next, *item + 1);
+        ret = 1;
+        }
+    pthread_mutex_unlock (&s->lock);
+    return ret;
+    }
+
+/* Move the upper half of the fullest other slice into slice SELF.
+   Returns zero once every slice is empty.  */
+
+static int
+steal (struct workq *q, int self)
+    {
+    for (;;)
+        {
+        struct slice *victim = NULL;
+        size_t most = 0, mid, end;
+        int i;
+
+        for (i = 0; i < q->nthreads; i++)
+            {
+            struct slice *s = &q->slices[i];
+            size_t left;
+
+            if (i == self)
+                continue;
+            /* An unlocked peek; it is checked again under the lock.  */
+            left = LOAD (s->end) > LOAD (s->next)
+                   ? LOAD (s->end) - LOAD (s->next) : 0;
+            if (left > most)
+                {
+                most = left;
+                victim = s;
+                }
+            }
+
+        if (victim == NULL)
+            return 0;
+
+        pthread_mutex_lock (&victim->lock);
+        if (LOAD (victim->next) >= LOAD (victim->end))
+            {
+            pthread_mutex_unlock (&victim->lock);
+            continue;
+            }
+        end = LOAD (victim->end);
+        mid = LOAD (victim->next) + (end - LOAD (victim->next)) / 2;
+        STORE (victim->end, mid);
+        pthread_mutex_unlock (&victim->lock);
+
+        pthread_mutex_lock (&q->slices[self].lock);
+        STORE (q->slices[self].next, mid);
+        STORE (q->slices[self].end, end);
+        pthread_mutex_unlock (&q->slices[self].lock);
+        return 1;
+        }
+    }
+
+static void *
+worker_main (void *arg)
+    {
+    struct worker *w = (struct worker *) arg;
+    struct workq *q = w->q;
+    size_t item;
+
+    do
+        while (take (&q->slices[w->id], &item))
+            q->fn (item, q->data);
+    while (steal (q, w->id));
+
+    return NULL;
+    }
+
+void
+workq_run (size_t n, int nthreads, workq_fn fn, void *data)
+    {
+    struct workq q;
+    struct worker *workers;
+    pthread_t *threads;
+    size_t i;
+    int t, started;
+
+    if (nthreads > 1 && (size_t) nthreads > n)
+        nthreads = n;
+
+    q.slices = NULL;
+    workers = NULL;
+    threads = NULL;
+    if (nthreads > 1)
+        {
+        q.slices = calloc (nthreads, sizeof (struct slice));
+        workers = calloc (nthreads, sizeof (struct worker));
+        threads = calloc (nthreads, sizeof (pthread_t));
+        }
+
+    if (q.slices == NULL || workers == NULL || threads == NULL)
+        {
+        free (q.slices);
+        free (workers);
+        free (threads);
+        for (i = 0; i < n; i++)
+            fn (i, data);
+        return;
+        }
+
+    q.nthreads = nthreads;
+    q.fn = fn;
+    q.data = data;
+    for (t = 0; t < nthreads; t++)
+        {
+        pthread_mutex_init (&q.slices[t].lock, NULL);
+        q.slices[t].next = n * t / nthreads;
+        q.slices[t].end = n * (t + 1) / nthreads;
+        workers[t].q = &q;
+        workers[t].id = t;
+        }
+
+    /* The calling thread is worker 0.  A thread that cannot be started
+       simply leaves its slice to be stolen by the others.  */
+    started = 0;
+    for (t = 1; t < nthreads; t++)
+        if (pthread_create (&threads[t], NULL, worker_main, &workers[t]) == 0)
+            threads[started++] = threads[t];
+
+    worker_main (&workers[0]);
+
+    for (t = 0; t < started; t++)
+        pthread_join (threads[t], NULL);
+
+    for (t = 0; t < nthreads; t++)
+        pthread_mutex_destroy (&q.slices[t].lock);
+    free (q.slices);
+    free (workers);
+    free (threads);
+    }
@@ -0,0 +1,46 @@
+/* A minimal work-stealing thread pool.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.  */
+
+/* workq_run calls a function once for every index in [0, N), spread
+   over a number of threads.  Each thread starts with a contiguous slice
+   of the indices and, once it has run out, steals the upper half of
+   whatever is left in the busiest other slice.  Items are independent
+   and may complete in any order; callers that need ordered output must
+   collect it per item.  */
+
+#ifndef __WORKQ_H__
+#define __WORKQ_H__
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/* Called for each item; the second argument is the DATA handed to
+   workq_run.  */
+typedef void (*workq_fn) (size_t, void *);
+
+/* Run FN on items 0 .. N-1 using up to NTHREADS threads, and return
+   once all of them are done.  With NTHREADS <= 1, or too few items to
+   share, everything is run in order on the calling thread.  */
+extern void	workq_run	(size_t, int, workq_fn, void *);
+
+#ifdef __cplusplus
+    }
+#endif /* __cplusplus */
+
+#endif /* __WORKQ_H__ */